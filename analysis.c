@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) 2013 Toni Spets <toni.spets@iki.fi>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Analysis cache file: magic, version and the identity of the module build,
+ * then for each section its record size, its length and the raw bytes. The
+ * sections are opaque here, the plugin rebases them. A cache written with
+ * other record sizes is refused rather than misread.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "backup.h"
+#include "analysis.h"
+
+#define ANALYSIS_MAGIC      "UBAN"
+#define ANALYSIS_VERSION    1
+#define ANALYSIS_MAX        (256 * 1024 * 1024)     // Sanity limit of one section
+
+bool analysis_save(const char *filename, const analysis_t *a, char *message)
+{
+    char tmp[260 + 4];
+    unsigned int version = ANALYSIS_VERSION;
+
+    FILE *fh = backup_create(filename, tmp, sizeof tmp, message);
+    if (!fh)
+        return false;
+
+    bool ok = fwrite(ANALYSIS_MAGIC, 4, 1, fh) == 1
+        && fwrite(&version, sizeof version, 1, fh) == 1
+        && fwrite(a->identity, sizeof a->identity, 1, fh) == 1;
+
+    for (int i = 0; ok && i < ANALYSIS_SECTIONS; i++) {
+        ok = fwrite(&a->itemsize[i], sizeof a->itemsize[i], 1, fh) == 1
+            && fwrite(&a->size[i], sizeof a->size[i], 1, fh) == 1
+            && (a->size[i] == 0 || fwrite(a->data[i], a->size[i], 1, fh) == 1);
+    }
+
+    if (!backup_commit(fh, ok, tmp, filename)) {
+        sprintf(message, "Failed to write %s", filename);
+        return false;
+    }
+
+    return true;
+}
+
+// Fills a with the cache, the caller checks the identity and record sizes
+bool analysis_load(const char *filename, analysis_t *a, char *message)
+{
+    char magic[4];
+    unsigned int version;
+
+    memset(a, 0, sizeof *a);
+
+    FILE *fh = fopen(filename, "rb");
+    if (!fh) {
+        sprintf(message, "Failed to open %s for reading", filename);
+        return false;
+    }
+
+    bool ok = fread(magic, 4, 1, fh) == 1 && memcmp(magic, ANALYSIS_MAGIC, 4) == 0
+        && fread(&version, sizeof version, 1, fh) == 1 && version == ANALYSIS_VERSION
+        && fread(a->identity, sizeof a->identity, 1, fh) == 1;
+
+    a->identity[sizeof a->identity - 1] = '\0';
+
+    for (int i = 0; ok && i < ANALYSIS_SECTIONS; i++) {
+        ok = fread(&a->itemsize[i], sizeof a->itemsize[i], 1, fh) == 1
+            && fread(&a->size[i], sizeof a->size[i], 1, fh) == 1
+            && a->size[i] <= ANALYSIS_MAX
+            && (a->itemsize[i] == 0 || a->size[i] % a->itemsize[i] == 0);
+
+        if (ok && a->size[i]) {
+            a->data[i] = malloc(a->size[i]);
+            ok = a->data[i] && fread(a->data[i], a->size[i], 1, fh) == 1;
+        }
+    }
+
+    fclose(fh);
+
+    if (!ok) {
+        analysis_free(a);
+        sprintf(message, "%s is not an analysis cache of this version", filename);
+        return false;
+    }
+
+    return true;
+}
+
+// Whether two caches hold the same build and the same analysis
+bool analysis_equal(const analysis_t *a, const analysis_t *b)
+{
+    if (strcmp(a->identity, b->identity) != 0)
+        return false;
+
+    for (int i = 0; i < ANALYSIS_SECTIONS; i++) {
+        if (a->itemsize[i] != b->itemsize[i] || a->size[i] != b->size[i])
+            return false;
+        if (a->size[i] && memcmp(a->data[i], b->data[i], a->size[i]) != 0)
+            return false;
+    }
+
+    return true;
+}
+
+void analysis_free(analysis_t *a)
+{
+    for (int i = 0; i < ANALYSIS_SECTIONS; i++) {
+        free(a->data[i]);
+        a->data[i] = NULL;
+        a->size[i] = 0;
+    }
+}
@@ -0,0 +1,26 @@
+#include <stdbool.h>
+
+#define ANALYSIS_PROCS      0       // t_procdata, addr relative to the module
+#define ANALYSIS_JUMPS      1       // analysis_jump_t
+#define ANALYSIS_LOOPS      2       // Loop brackets as Nesteddatatoudd packs them
+#define ANALYSIS_ARGS       3       // Call argument brackets, same
+#define ANALYSIS_SECTIONS   4
+
+typedef struct analysis_jump_t {
+    unsigned int from;          // RVA of the jump or call
+    unsigned int dest;          // RVA of its destination
+    unsigned int type;          // JT_xxx
+} analysis_jump_t;
+
+// Analysis results of one build of a module, MODULE-analysis.bin
+typedef struct analysis_t {
+    char identity[64];          // backup_identity_string of the build
+    void *data[ANALYSIS_SECTIONS];
+    unsigned int size[ANALYSIS_SECTIONS];       // Bytes
+    unsigned int itemsize[ANALYSIS_SECTIONS];   // Size of one record, 0 for packed data
+} analysis_t;
+
+bool analysis_save(const char *filename, const analysis_t *a, char *message);
+bool analysis_load(const char *filename, analysis_t *a, char *message);
+bool analysis_equal(const analysis_t *a, const analysis_t *b);
+void analysis_free(analysis_t *a);
@@ -16,110 +16,205 @@
 
 #include <windows.h>
 #include <stdio.h>
+#include <stdint.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#include <nmmintrin.h>
 #include "backup.h"
 #include "list.h"
-#include "libcsv/csv.h"
 
 BOOL WINAPI DllMainCRTStartup(HINSTANCE hinstDLL, DWORD fdwReason, LPVOID lpvReserved) { return TRUE; }
 
-typedef void (*cb1)(void *, size_t, void *);
-typedef void (*cb2)(int, void *);
-
-struct csv_data {
-    int labels;
-    int comments;
-    int index;
-    char address[9];
-    union {
-        char label[256];
-        char type[256];
-    };
-    union {
-        char comment[256];
-        char name[256];
-    };
-    rva_t *rvas;
-};
-
-static void csv_value(void *rbuf, size_t len, struct csv_data *data)
+static unsigned int crc32c_table[256];
+
+static unsigned int crc32c_sw(unsigned int crc, const unsigned char *p, size_t len)
 {
-    char buf[256];
+    while (len--)
+        crc = crc32c_table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
 
-    if (len > sizeof(buf) - 1)
-        len = sizeof(buf) - 1;
-    memcpy(buf, rbuf, len);
-    buf[len] = '\0';
+    return crc;
+}
 
-    if (data->index == 0)
-        strcpy_s(data->address, sizeof(data->address), buf);
+#ifndef _MSC_VER
+__attribute__((target("sse4.2")))
+#endif
+static unsigned int crc32c_hw(unsigned int crc, const unsigned char *p, size_t len)
+{
+    while (len && ((uintptr_t)p & 3)) {
+        crc = _mm_crc32_u8(crc, *p++);
+        len--;
+    }
 
-    if (data->index == 1)
-        strcpy_s(data->label, sizeof(data->label), buf);
+    for (; len >= 4; p += 4, len -= 4)
+        crc = _mm_crc32_u32(crc, *(const unsigned int *)p);
 
-    if (data->index == 2)
-        strcpy_s(data->comment, sizeof(data->comment), buf);
+    while (len--)
+        crc = _mm_crc32_u8(crc, *p++);
 
-    data->index++;
+    return crc;
 }
 
-static void csv_eol(int x, struct csv_data *data)
+unsigned int backup_crc32c(unsigned int crc, const void *data, size_t len)
 {
-    long int address = strtol(data->address, NULL, 16);
+    static int sse42 = -1;
+
+    if (sse42 < 0) {
+#ifdef _MSC_VER
+        int info[4];
+        __cpuid(info, 1);
+        sse42 = (info[2] >> 20) & 1;
+#else
+        unsigned int a, b, c, d;
+        sse42 = __get_cpuid(1, &a, &b, &c, &d) ? (c >> 20) & 1 : 0;
+#endif
+        for (unsigned int i = 0; i < 256; i++) {
+            unsigned int v = i;
+            for (int k = 0; k < 8; k++)
+                v = v & 1 ? (v >> 1) ^ 0x82F63B78 : v >> 1;
+            crc32c_table[i] = v;
+        }
+    }
 
-    if (strcmp(data->address, "RVA") != 0 && (data->label[0] || data->comment[0])) {
-        rva_t *rva = malloc(sizeof(rva_t));
+    crc = ~crc;
+    crc = sse42 ? crc32c_hw(crc, data, len) : crc32c_sw(crc, data, len);
+    return ~crc;
+}
 
-        rva->address = address;
-        strcpy_s(rva->label, sizeof(rva->label), data->label);
-        strcpy_s(rva->comment, sizeof(rva->label), data->comment);
+typedef struct identity_cache_t {
+    wchar_t path[MAX_PATH];
+    FILETIME mtime;
+    unsigned int size;
+    identity_t identity;
+    struct identity_cache_t *next;
+} identity_cache_t;
 
-        LIST_INSERT(data->rvas, rva);
+static identity_cache_t *identity_cache = NULL;
 
-        if (data->label[0]) {
-            data->labels++;
-        }
+static unsigned int read32(const unsigned char *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (unsigned int)p[3] << 24;
+}
 
-        if (data->comment[0]) {
-            data->comments++;
-        }
-    }
+static void hash_image(const unsigned char *image, unsigned int size, identity_t *identity)
+{
+    identity->crc = backup_crc32c(0, image, size);
+
+    if (size < 0x40 || image[0] != 'M' || image[1] != 'Z')
+        return;
+
+    unsigned int pe = read32(image + 0x3C);
+    if (pe > size - 24 || memcmp(image + pe, "PE\0\0", 4) != 0)
+        return;
+
+    unsigned int nsections = image[pe + 6] | image[pe + 7] << 8;
+    unsigned int optsize = image[pe + 20] | image[pe + 21] << 8;
+    unsigned int sect = pe + 24 + optsize;
+
+    identity->timestamp = read32(image + pe + 8);
 
-    data->index = 0;
-    data->address[0] = '\0';
-    data->label[0] = '\0';
-    data->comment[0] = '\0';
+    for (unsigned int i = 0; i < nsections && identity->nsections < IDENTITY_SECTIONS; i++, sect += 40) {
+        if (sect + 40 > size)
+            break;
+
+        unsigned int rawsize = read32(image + sect + 16);
+        unsigned int rawptr = read32(image + sect + 20);
+
+        if (rawptr > size || rawsize > size - rawptr)
+            rawsize = rawptr > size ? 0 : size - rawptr;
+
+        identity->sections[identity->nsections++] = backup_crc32c(0, image + rawptr, rawsize);
+    }
 }
 
-rva_t *backup_load(const char *filename, char *message)
+bool backup_identity(const wchar_t *path, identity_t *identity)
 {
-    char row[2048];
-    struct csv_data data;
-    struct csv_parser p;
-    csv_init(&p, 0);
+    WIN32_FILE_ATTRIBUTE_DATA attr;
+
+    memset(identity, 0, sizeof *identity);
 
-    memset(&data, 0, sizeof data);
+    if (!GetFileAttributesExW(path, GetFileExInfoStandard, &attr) || attr.nFileSizeHigh)
+        return false;
 
-    FILE *fh = fopen(filename, "rb");
-    if (!fh) {
-        sprintf(message, "Failed to open %s for reading", filename);
-        return NULL;
+    identity_cache_t *cached = NULL;
+
+    // the file only gets hashed again when it changes on disk, and then
+    // takes over its old entry so there is one per path
+    LIST_FOREACH (identity_cache, identity_cache_t, el) {
+        if (wcscmp(el->path, path) != 0)
+            continue;
+
+        if (el->size == attr.nFileSizeLow && memcmp(&el->mtime, &attr.ftLastWriteTime, sizeof el->mtime) == 0) {
+            *identity = el->identity;
+            return true;
+        }
+
+        cached = el;
+        break;
     }
 
-    while (fgets(row, sizeof row, fh)) {
-        csv_parse(&p, row, strlen(row), (cb1)csv_value, (cb2)csv_eol, &data);
+    HANDLE file = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+
+    identity->size = attr.nFileSizeLow;
+
+    if (identity->size) {
+        HANDLE mapping = CreateFileMappingW(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        const unsigned char *image = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+
+        if (image) {
+            hash_image(image, identity->size, identity);
+            UnmapViewOfFile(image);
+        }
+
+        if (mapping)
+            CloseHandle(mapping);
     }
 
-    csv_fini(&p, (cb1)csv_value, (cb2)csv_eol, NULL);
-    csv_free(&p);
+    CloseHandle(file);
+
+    if (!cached) {
+        cached = LIST_ALLOC(identity_cache_t);
+        wcsncpy(cached->path, path, MAX_PATH - 1);
+        LIST_INSERT(identity_cache, cached);
+    }
 
-    fclose(fh);
+    cached->mtime = attr.ftLastWriteTime;
+    cached->size = attr.nFileSizeLow;
+    cached->identity = *identity;
 
-    if (data.rvas == NULL)
-    {
-        sprintf(message, "File %s didn't have any labels or comments", filename);
-        return NULL;
+    return true;
+}
+
+void backup_free_identities(void)
+{
+    LIST_FREE(identity_cache);
+}
+
+int backup_compare_identity(const identity_t *a, const identity_t *b)
+{
+    // 0 only when the whole file matches, otherwise the number of differing
+    // sections, IDENTITY_OUTSIDE if they all match or IDENTITY_LAYOUT if
+    // there are none to compare
+    if (a->size == b->size && a->timestamp == b->timestamp && a->crc == b->crc)
+        return 0;
+
+    if (a->nsections != b->nsections || a->nsections == 0)
+        return IDENTITY_LAYOUT;
+
+    int differ = 0;
+    for (int i = 0; i < a->nsections; i++) {
+        if (a->sections[i] != b->sections[i])
+            differ++;
     }
 
-    sprintf(message, "Loaded %d labels and %d comments from %s", data.labels, data.comments, filename);
-    return data.rvas;
-}
\ No newline at end of file
+    return differ ? differ : IDENTITY_OUTSIDE;
+}
+
+void backup_identity_string(const identity_t *identity, char *buf, size_t len)
+{
+    snprintf(buf, len, "%08X-%08X-%08X", identity->size, identity->timestamp, identity->crc);
+}
@@ -1,4 +1,5 @@
 #include <stdbool.h>
+#include <stddef.h>
 
 #define REV L"318"
 
@@ -16,5 +17,70 @@ typedef struct rva_t {
     struct rva_t *next;
 } rva_t;
 
-rva_t *backup_load(const char *filename, char *message);
+typedef struct name_t {
+    unsigned int address;
+    int type;
+    unsigned int name;          // offset of the UTF-8 name in names_t.pool
+} name_t;
+
+typedef struct names_t {
+    name_t *items;
+    int count;
+    int capacity;
+    char *pool;
+    size_t pool_used;
+    size_t pool_size;
+} names_t;
+
+#define NAMES_STR(names, i) ((names)->pool + (names)->items[i].name)
+
+#define IDENTITY_SECTIONS 16
+#define IDENTITY_LAYOUT     -1      // The files differ and their sections can't be compared
+#define IDENTITY_OUTSIDE    -2      // Every section matches but the rest of the file differs
+
+typedef struct identity_t {
+    unsigned int size;          // Size of the executable file
+    unsigned int timestamp;     // TimeDateStamp from the PE header
+    unsigned int crc;           // CRC32C of the whole file
+    int nsections;
+    unsigned int sections[IDENTITY_SECTIONS];   // CRC32C of the raw data of each section
+} identity_t;
+
+typedef const char *(*type_string_t)(int type);
+typedef int (*parse_type_t)(const char *type);
+
+typedef struct archive_t {
+    char module[128];           // UTF-8 short name of the module
+    unsigned int base;
+    unsigned int size;
+    char identity[128];
+    names_t names;
+    struct archive_t *next;
+} archive_t;
+
+#define BACKUP_HASH_INIT 2166136261u
+
+rva_t *backup_load(const char *filename, identity_t *identity, char *message);
 bool backup_save(const char *filename, rva_t *rvas, char *message);
+unsigned int backup_hash(unsigned int hash, const void *data, size_t len);
+int backup_write_row(FILE *fh, unsigned int address, const char *type, const char *name);
+bool backup_replace_file(const char *from, const char *to);
+FILE *backup_create(const char *filename, char *tmp, size_t size, char *message);
+bool backup_commit(FILE *fh, bool ok, const char *tmp, const char *filename);
+
+unsigned int backup_crc32c(unsigned int crc, const void *data, size_t len);
+bool backup_identity(const wchar_t *path, identity_t *identity);
+void backup_free_identities(void);
+bool backup_read_identity(const char *filename, identity_t *identity);
+void backup_write_identity(FILE *fh, const identity_t *identity);
+int backup_compare_identity(const identity_t *a, const identity_t *b);
+void backup_identity_string(const identity_t *identity, char *buf, size_t len);
+
+bool names_add(names_t *names, unsigned int address, int type, const char *name);
+bool names_add_n(names_t *names, unsigned int address, int type, const char *name, size_t len);
+void names_sort(names_t *names);
+void names_free(names_t *names);
+
+bool backup_save_archive(const char *filename, archive_t *modules, type_string_t type_string, char *message);
+archive_t *backup_load_archive(const char *filename, parse_type_t parse_type, char *message);
+void backup_free_archive(archive_t *modules);
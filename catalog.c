@@ -0,0 +1,222 @@
+/*
+ * Copyright (c) 2013 Toni Spets <toni.spets@iki.fi>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * The catalog lists every snapshot saved of a module, one row per file, so
+ * the history can be shown without opening the snapshots. Saving a file
+ * again replaces its row. The catalog is rewritten to a temporary file and
+ * moved over the old one, a reader never sees it half written.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "backup.h"
+#include "catalog.h"
+#include "list.h"
+#include "libcsv/csv.h"
+
+static const char header[] = "file,saved,profile,names,counts,identity,hash,size\r\n";
+
+typedef struct catalog_parse_t {
+    catalog_t *entries;
+    catalog_t *last;
+    catalog_t row;
+    int field;
+    int rows;
+} catalog_parse_t;
+
+static void copy_field(char *dst, size_t size, const char *src, size_t len)
+{
+    if (len >= size)
+        len = size - 1;
+
+    memcpy(dst, src, len);
+    dst[len] = '\0';
+}
+
+static void catalog_field(void *s, size_t len, void *data)
+{
+    catalog_parse_t *p = data;
+    catalog_t *row = &p->row;
+
+    switch (p->field++) {
+        case 0: copy_field(row->file, sizeof row->file, s, len); break;
+        case 1: copy_field(row->saved, sizeof row->saved, s, len); break;
+        case 2: copy_field(row->profile, sizeof row->profile, s, len); break;
+        case 3: row->names = atoi(s); break;
+        case 4: copy_field(row->counts, sizeof row->counts, s, len); break;
+        case 5: copy_field(row->identity, sizeof row->identity, s, len); break;
+        case 6: row->hash = strtoul(s, NULL, 16); break;
+        case 7: row->size = strtoul(s, NULL, 10); break;
+    }
+}
+
+static void catalog_row(int c, void *data)
+{
+    catalog_parse_t *p = data;
+
+    // the first row is the header, rows without a file are skipped
+    if (p->rows++ > 0 && p->field >= 4 && p->row.file[0]) {
+        catalog_t *entry = malloc(sizeof(catalog_t));
+
+        if (entry) {
+            *entry = p->row;
+            entry->next = NULL;
+
+            // kept in file order, which is the order they were saved in
+            if (p->last)
+                p->last->next = entry;
+            else
+                p->entries = entry;
+            p->last = entry;
+        }
+    }
+
+    memset(&p->row, 0, sizeof p->row);
+    p->field = 0;
+}
+
+catalog_t *catalog_load(const char *filename, char *message)
+{
+    char buf[4096];
+    size_t len;
+    struct csv_parser parser;
+    catalog_parse_t p = { 0 };
+
+    FILE *fh = fopen(filename, "rb");
+    if (!fh) {
+        sprintf(message, "No catalog at %s", filename);
+        return NULL;
+    }
+
+    csv_init(&parser, CSV_APPEND_NULL);
+
+    while ((len = fread(buf, 1, sizeof buf, fh)) > 0)
+        csv_parse(&parser, buf, len, catalog_field, catalog_row, &p);
+
+    csv_fini(&parser, catalog_field, catalog_row, &p);
+    csv_free(&parser);
+    fclose(fh);
+
+    if (!p.entries)
+        sprintf(message, "Catalog %s is empty", filename);
+
+    return p.entries;
+}
+
+static void write_field(FILE *fh, const char *s)
+{
+    if (strpbrk(s, ",\"\r\n"))
+        csv_fwrite(fh, s, strlen(s));
+    else
+        fputs(s, fh);
+}
+
+static void write_entry(FILE *fh, const catalog_t *entry)
+{
+    write_field(fh, entry->file);
+    fprintf(fh, ",%s,", entry->saved);
+    write_field(fh, entry->profile);
+    fprintf(fh, ",%d,%s,%s,%08X,%u\r\n", entry->names, entry->counts, entry->identity, entry->hash, entry->size);
+}
+
+static bool listed(const catalog_t *entries, const char *file)
+{
+    LIST_FOREACH (entries, const catalog_t, entry) {
+        if (strcmp(entry->file, file) == 0)
+            return true;
+    }
+
+    return false;
+}
+
+// Writes the entries in order, leaving out those listed in skip
+static bool write_catalog(const char *filename, const catalog_t *entries, const catalog_t *skip, const catalog_t *append, char *message)
+{
+    char tmp[CATALOG_PATH + 8];
+    int count = 0;
+
+    FILE *fh = backup_create(filename, tmp, sizeof tmp, message);
+    if (!fh)
+        return false;
+
+    fwrite(header, sizeof header - 1, 1, fh);
+
+    LIST_FOREACH (entries, const catalog_t, entry) {
+        if (!listed(skip, entry->file)) {
+            write_entry(fh, entry);
+            count++;
+        }
+    }
+
+    if (append) {
+        write_entry(fh, append);
+        count++;
+    }
+
+    if (!backup_commit(fh, true, tmp, filename)) {
+        sprintf(message, "Catalog %s could not be written", filename);
+        return false;
+    }
+
+    sprintf(message, "Catalog %s lists %d snapshots", filename, count);
+    return true;
+}
+
+bool catalog_update(const char *filename, const catalog_t *entry, char *message)
+{
+    char ignored[1024];
+    catalog_t *entries = catalog_load(filename, ignored);
+
+    // the entry doubles as a one item skip list, its next is not followed
+    catalog_t skip = *entry;
+    skip.next = NULL;
+
+    bool ret = write_catalog(filename, entries, &skip, entry, message);
+
+    LIST_FREE(entries);
+    return ret;
+}
+
+// Drops the rows of the removed snapshots, rows added since stay
+bool catalog_remove(const char *filename, const catalog_t *removed, char *message)
+{
+    catalog_t *entries = catalog_load(filename, message);
+
+    if (!entries)
+        return false;
+
+    bool ret = write_catalog(filename, entries, removed, NULL, message);
+
+    LIST_FREE(entries);
+    return ret;
+}
+
+// Count of names of the type recorded for the snapshot, zero if none
+int catalog_count(const catalog_t *entry, const char *type)
+{
+    size_t len = strlen(type);
+    const char *p = entry->counts;
+
+    while ((p = strstr(p, type)) != NULL) {
+        if ((p == entry->counts || p[-1] == ' ') && p[len] == '=')
+            return atoi(p + len + 1);
+        p += len;
+    }
+
+    return 0;
+}
@@ -0,0 +1,27 @@
+#ifndef CATALOG_H__
+#define CATALOG_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define CATALOG_PATH    260
+
+// One snapshot as recorded in MODULE-catalog.csv
+typedef struct catalog_t {
+    char file[CATALOG_PATH];    // Snapshot file name, relative to the catalog
+    char saved[20];             // Local time as YYYY-MM-DD HH:MM:SS
+    char profile[32];
+    int names;
+    char counts[256];           // TYPE=count pairs separated by spaces
+    char identity[64];          // backup_identity_string, empty if unknown
+    unsigned int hash;          // Hash of the saved rows
+    unsigned int size;          // Size of the file in bytes
+    struct catalog_t *next;
+} catalog_t;
+
+catalog_t *catalog_load(const char *filename, char *message);
+bool catalog_update(const char *filename, const catalog_t *entry, char *message);
+bool catalog_remove(const char *filename, const catalog_t *removed, char *message);
+int catalog_count(const catalog_t *entry, const char *type);
+
+#endif
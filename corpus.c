@@ -0,0 +1,253 @@
+/*
+ * Copyright (c) 2013 Toni Spets <toni.spets@iki.fi>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Signature corpus file: magic, version, entry count, pool size and Bloom
+ * filter size in bits, then the filter, the entries sorted by fingerprint
+ * and the label pool. Most procedures of a module are not in the corpus,
+ * the filter turns those away with a few bit tests before the binary
+ * search over the entries is needed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "backup.h"
+#include "corpus.h"
+
+#define CORPUS_MAGIC        "UBSC"
+#define CORPUS_VERSION      1
+#define BLOOM_BITS          10      // Filter bits per entry, about 1% false positives
+#define BLOOM_HASHES        7
+
+bool corpus_add(corpus_t *corpus, unsigned long long hash, unsigned int size, const char *label)
+{
+    size_t len = strlen(label) + 1;
+
+    if (corpus->count == corpus->capacity) {
+        int capacity = corpus->capacity ? corpus->capacity * 2 : 1024;
+        corpus_entry_t *items = realloc(corpus->items, capacity * sizeof(corpus_entry_t));
+        if (!items)
+            return false;
+        corpus->items = items;
+        corpus->capacity = capacity;
+    }
+
+    if (corpus->pool_used + len > corpus->pool_size) {
+        size_t pool_size = corpus->pool_size ? corpus->pool_size * 2 : 65536;
+        while (pool_size < corpus->pool_used + len)
+            pool_size *= 2;
+        char *pool = realloc(corpus->pool, pool_size);
+        if (!pool)
+            return false;
+        corpus->pool = pool;
+        corpus->pool_size = pool_size;
+    }
+
+    corpus_entry_t *item = &corpus->items[corpus->count++];
+    item->hash = hash;
+    item->size = size;
+    item->label = corpus->pool_used;
+
+    memcpy(corpus->pool + corpus->pool_used, label, len);
+    corpus->pool_used += len;
+
+    return true;
+}
+
+static int corpus_cmp(const void *a, const void *b)
+{
+    const corpus_entry_t *x = a;
+    const corpus_entry_t *y = b;
+
+    if (x->hash != y->hash)
+        return x->hash < y->hash ? -1 : 1;
+
+    return x->size < y->size ? -1 : x->size > y->size;
+}
+
+static const char *corpus_label(const corpus_t *corpus, const corpus_entry_t *entry)
+{
+    return entry->label == CORPUS_CONFLICT ? NULL : corpus->pool + entry->label;
+}
+
+// Double hashing, the fingerprints are already well mixed
+static unsigned int bloom_bit(unsigned long long hash, int i, unsigned int bits)
+{
+    unsigned int h1 = (unsigned int)hash;
+    unsigned int h2 = (unsigned int)(hash >> 32) | 1;
+
+    return (h1 + i * h2) & (bits - 1);
+}
+
+// Sorts the entries, merges those of the same procedure and rebuilds the
+// pool and the filter. A procedure added with two different labels keeps
+// neither.
+bool corpus_finish(corpus_t *corpus)
+{
+    size_t pool_size = corpus->pool_used ? corpus->pool_used : 1;
+    char *pool = malloc(pool_size);
+    size_t pool_used = 0;
+    int n = 0;
+
+    if (!pool)
+        return false;
+
+    qsort(corpus->items, corpus->count, sizeof(corpus_entry_t), corpus_cmp);
+
+    for (int i = 0; i < corpus->count; ) {
+        const corpus_entry_t *first = &corpus->items[i];
+        const char *label = corpus_label(corpus, first);
+        int j = i + 1;
+
+        for (; j < corpus->count && corpus_cmp(first, &corpus->items[j]) == 0; j++) {
+            const char *other = corpus_label(corpus, &corpus->items[j]);
+            if (!label || !other || strcmp(label, other) != 0)
+                label = NULL;
+        }
+
+        corpus_entry_t entry = *first;
+
+        if (label) {
+            size_t len = strlen(label) + 1;
+            memcpy(pool + pool_used, label, len);
+            entry.label = pool_used;
+            pool_used += len;
+        } else {
+            entry.label = CORPUS_CONFLICT;
+        }
+
+        corpus->items[n++] = entry;
+        i = j;
+    }
+
+    free(corpus->pool);
+    corpus->pool = pool;
+    corpus->pool_used = pool_used;
+    corpus->pool_size = pool_size;
+    corpus->count = n;
+
+    unsigned int bits = 1024;
+    while (bits < (unsigned long long)n * BLOOM_BITS && bits < 0x80000000u)
+        bits *= 2;
+
+    free(corpus->bloom);
+    corpus->bloom = calloc(bits / 8, 1);
+    corpus->bloom_bits = corpus->bloom ? bits : 0;
+
+    for (int i = 0; corpus->bloom && i < n; i++) {
+        for (int k = 0; k < BLOOM_HASHES; k++) {
+            unsigned int bit = bloom_bit(corpus->items[i].hash, k, bits);
+            corpus->bloom[bit / 8] |= 1 << (bit % 8);
+        }
+    }
+
+    return corpus->bloom != NULL;
+}
+
+// Label of the procedure, NULL if it is not in the corpus or ambiguous
+const char *corpus_find(const corpus_t *corpus, unsigned long long hash, unsigned int size)
+{
+    for (int k = 0; k < BLOOM_HASHES && corpus->bloom_bits; k++) {
+        unsigned int bit = bloom_bit(hash, k, corpus->bloom_bits);
+        if (!(corpus->bloom[bit / 8] & (1 << (bit % 8))))
+            return NULL;
+    }
+
+    corpus_entry_t key = { hash, size, 0 };
+    const corpus_entry_t *entry = bsearch(&key, corpus->items, corpus->count, sizeof(corpus_entry_t), corpus_cmp);
+
+    return entry ? corpus_label(corpus, entry) : NULL;
+}
+
+bool corpus_save(const char *filename, const corpus_t *corpus, char *message)
+{
+    char tmp[260 + 4];
+    unsigned int header[4] = { CORPUS_VERSION, corpus->count, corpus->pool_used, corpus->bloom_bits };
+
+    FILE *fh = backup_create(filename, tmp, sizeof tmp, message);
+    if (!fh)
+        return false;
+
+    bool ok = fwrite(CORPUS_MAGIC, 4, 1, fh) == 1
+        && fwrite(header, sizeof header, 1, fh) == 1
+        && (!corpus->bloom_bits || fwrite(corpus->bloom, corpus->bloom_bits / 8, 1, fh) == 1)
+        && (!corpus->count || fwrite(corpus->items, sizeof(corpus_entry_t), corpus->count, fh) == (size_t)corpus->count)
+        && (!corpus->pool_used || fwrite(corpus->pool, corpus->pool_used, 1, fh) == 1);
+
+    if (!backup_commit(fh, ok, tmp, filename)) {
+        sprintf(message, "Failed to write %s", filename);
+        return false;
+    }
+
+    sprintf(message, "Saved %d signatures to %s", corpus->count, filename);
+    return true;
+}
+
+bool corpus_load(const char *filename, corpus_t *corpus, char *message)
+{
+    char magic[4];
+    unsigned int header[4];
+
+    memset(corpus, 0, sizeof *corpus);
+
+    FILE *fh = fopen(filename, "rb");
+    if (!fh) {
+        sprintf(message, "Failed to open %s for reading", filename);
+        return false;
+    }
+
+    bool ok = fread(magic, 4, 1, fh) == 1 && memcmp(magic, CORPUS_MAGIC, 4) == 0
+        && fread(header, sizeof header, 1, fh) == 1 && header[0] == CORPUS_VERSION
+        && header[1] < 0x10000000 && (header[3] & (header[3] - 1)) == 0 && header[3] >= 8;
+
+    if (ok) {
+        corpus->count = corpus->capacity = header[1];
+        corpus->pool_used = corpus->pool_size = header[2];
+        corpus->bloom_bits = header[3];
+        corpus->bloom = malloc(corpus->bloom_bits / 8);
+        corpus->items = malloc(corpus->count * sizeof(corpus_entry_t) + 1);
+        corpus->pool = malloc(corpus->pool_used + 1);
+
+        ok = corpus->bloom && corpus->items && corpus->pool
+            && fread(corpus->bloom, corpus->bloom_bits / 8, 1, fh) == 1
+            && (!corpus->count || fread(corpus->items, sizeof(corpus_entry_t), corpus->count, fh) == (size_t)corpus->count)
+            && (!corpus->pool_used || fread(corpus->pool, corpus->pool_used, 1, fh) == 1);
+    }
+
+    fclose(fh);
+
+    for (int i = 0; ok && i < corpus->count; i++) {
+        unsigned int label = corpus->items[i].label;
+        ok = label == CORPUS_CONFLICT || (label < corpus->pool_used && memchr(corpus->pool + label, '\0', corpus->pool_used - label));
+    }
+
+    if (!ok) {
+        corpus_free(corpus);
+        sprintf(message, "%s is truncated or not a signature corpus", filename);
+        return false;
+    }
+
+    return true;
+}
+
+void corpus_free(corpus_t *corpus)
+{
+    free(corpus->items);
+    free(corpus->pool);
+    free(corpus->bloom);
+    memset(corpus, 0, sizeof *corpus);
+}
@@ -0,0 +1,30 @@
+#include <stdbool.h>
+#include <stddef.h>
+
+#define CORPUS_MINSIZE      16              // Smaller procedures are too common to tell apart
+#define CORPUS_CONFLICT     0xFFFFFFFFu     // Label of a fingerprint seen with different labels
+
+typedef struct corpus_entry_t {
+    unsigned long long hash;    // fingerprint_t.hash
+    unsigned int size;
+    unsigned int label;         // offset of the UTF-8 label in corpus_t.pool, or CORPUS_CONFLICT
+} corpus_entry_t;
+
+// Labels of procedures from any number of modules, backup-corpus.bin
+typedef struct corpus_t {
+    corpus_entry_t *items;      // sorted by hash and size after corpus_finish
+    int count;
+    int capacity;
+    char *pool;
+    size_t pool_used;
+    size_t pool_size;
+    unsigned char *bloom;
+    unsigned int bloom_bits;    // power of two
+} corpus_t;
+
+bool corpus_add(corpus_t *corpus, unsigned long long hash, unsigned int size, const char *label);
+bool corpus_finish(corpus_t *corpus);
+const char *corpus_find(const corpus_t *corpus, unsigned long long hash, unsigned int size);
+bool corpus_save(const char *filename, const corpus_t *corpus, char *message);
+bool corpus_load(const char *filename, corpus_t *corpus, char *message);
+void corpus_free(corpus_t *corpus);
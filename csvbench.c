@@ -0,0 +1,393 @@
+/*
+ * Copyright (c) 2013 Toni Spets <toni.spets@iki.fi>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Throughput of the snapshot hot paths on generated data: csv_parse alone,
+ * backup_load into a names_t the way snapshots are loaded, and writing rows
+ * with backup_write_row the way they are saved. Each case of the matrix
+ * runs a fixed number of times and is summarized by the median and the
+ * median absolute deviation. With -b the medians are checked against a
+ * baseline written earlier with -w, and a drop of more than the threshold
+ * that is also well outside the spread of the runs fails it.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "backup.h"
+#include "list.h"
+#include "libcsv/csv.h"
+
+#define MAX_CASES   32
+#define MIN_BYTES   (16 * 1024 * 1024)  // Data processed by one run, small inputs are repeated
+#define NOISE_MADS  2                   // A regression must also exceed this many MADs of spread
+
+static const char *types[] = { "LABEL", "COMMENT", "EXPORT", "IMPORT", "ANALYSIS_LABEL", "ANALYSIS_COMMENT" };
+
+typedef struct input_t {
+    const char *name;
+    int rows;
+    bool quoted;                // names that need CSV quoting
+    char *csv;
+    size_t size;
+    char path[32];              // the csv in a file, backup_load reads files
+    names_t names;
+} input_t;
+
+static input_t inputs[] = {
+    { "small", 1000, false },
+    { "small-quoted", 1000, true },
+    { "large", 200000, false },
+    { "large-quoted", 200000, true },
+};
+
+typedef struct bench_t {
+    const char *name;
+    size_t (*run)(input_t *input);
+} bench_t;
+
+typedef struct result_t {
+    char name[64];
+    double median;              // MB/s
+    double mad;
+} result_t;
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void generate(input_t *input)
+{
+    char name[128];
+    char *buf = NULL;
+    size_t size = 0;
+    FILE *fh = open_memstream(&buf, &size);
+
+    fprintf(fh, "RVA,label_type,label\r\n");
+
+    // fixed seed, every run and every machine sees the same rows
+    srand(1);
+
+    for (int i = 0; i < input->rows; i++) {
+        unsigned int address = 0x1000 + i * 16 + rand() % 16;
+        int type = rand() % (int)(sizeof types / sizeof *types);
+        int len;
+
+        if (input->quoted && i % 2)
+            len = snprintf(name, sizeof name, "call sub_%08X(%d, \"arg\"), check result", address, rand() % 100);
+        else
+            len = snprintf(name, sizeof name, "sub_%08X_handler_%d", address, rand() % 1000);
+
+        names_add_n(&input->names, address, type, name, len);
+
+        fprintf(fh, "%08X,%s,", address, types[type]);
+
+        if (strpbrk(name, ",\"\r\n"))
+            csv_fwrite(fh, name, len);
+        else
+            fwrite(name, len, 1, fh);
+
+        fwrite("\r\n", 2, 1, fh);
+    }
+
+    fclose(fh);
+
+    input->csv = buf;
+    input->size = size;
+
+    strcpy(input->path, "/tmp/csvbenchXXXXXX");
+    int fd = mkstemp(input->path);
+
+    if (fd < 0 || write(fd, buf, size) != (ssize_t)size) {
+        perror(input->path);
+        exit(2);
+    }
+
+    close(fd);
+}
+
+static void count_field(void *buf, size_t len, void *data)
+{
+    (*(size_t *)data)++;
+}
+
+static void count_row(int c, void *data)
+{
+}
+
+static size_t bench_parse(input_t *input)
+{
+    struct csv_parser p;
+    size_t fields = 0;
+
+    csv_init(&p, CSV_VIEW);
+    csv_parse(&p, input->csv, input->size, count_field, count_row, &fields);
+    csv_fini(&p, count_field, count_row, &fields);
+    csv_free(&p);
+
+    return input->size;
+}
+
+static int parse_type(const char *type)
+{
+    for (int i = 0; i < (int)(sizeof types / sizeof *types); i++) {
+        if (strcmp(types[i], type) == 0)
+            return i;
+    }
+
+    return -1;
+}
+
+// backup_load and the sorted name table the plugin builds from its rows
+static size_t bench_load(input_t *input)
+{
+    char message[1024];
+    names_t names = { 0 };
+    rva_t *rvas = backup_load(input->path, NULL, message);
+
+    LIST_FOREACH (rvas, rva_t, rva) {
+        int type = parse_type(rva->type);
+        if (type >= 0)
+            names_add(&names, rva->address, type, rva->name);
+    }
+
+    LIST_FREE(rvas);
+    names_sort(&names);
+
+    if (names.count != input->names.count) {
+        fprintf(stderr, "%s: loaded %d of %d names\n", input->name, names.count, input->names.count);
+        exit(2);
+    }
+
+    names_free(&names);
+    return input->size;
+}
+
+static size_t bench_write(input_t *input)
+{
+    static char buf[64 * 1024];
+    const names_t *names = &input->names;
+    FILE *fh = fopen("/dev/null", "wb");
+
+    if (!fh) {
+        perror("/dev/null");
+        exit(2);
+    }
+
+    setvbuf(fh, buf, _IOFBF, sizeof buf);
+
+    fprintf(fh, "RVA,label_type,label\r\n");
+
+    for (int i = 0; i < names->count; i++)
+        backup_write_row(fh, names->items[i].address, types[names->items[i].type], NAMES_STR(names, i));
+
+    fclose(fh);
+    return input->size;
+}
+
+static const bench_t benches[] = {
+    { "parse", bench_parse },
+    { "load", bench_load },
+    { "write", bench_write },
+};
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static double median(double *values, int n)
+{
+    qsort(values, n, sizeof(double), compare_double);
+    return n % 2 ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / 2;
+}
+
+static void measure(const bench_t *bench, input_t *input, int runs, result_t *result)
+{
+    double *mbs = calloc(runs, sizeof(double));
+    double *dev = calloc(runs, sizeof(double));
+    int repeat = MIN_BYTES / input->size + 1;
+
+    // warm the caches and the allocator once before timing
+    bench->run(input);
+
+    for (int r = 0; r < runs; r++) {
+        size_t bytes = 0;
+        double start = now();
+
+        for (int i = 0; i < repeat; i++)
+            bytes += bench->run(input);
+
+        mbs[r] = bytes / (now() - start) / (1024 * 1024);
+    }
+
+    snprintf(result->name, sizeof result->name, "%s/%s", bench->name, input->name);
+    result->median = median(mbs, runs);
+
+    for (int r = 0; r < runs; r++)
+        dev[r] = mbs[r] > result->median ? mbs[r] - result->median : result->median - mbs[r];
+
+    result->mad = median(dev, runs);
+
+    free(mbs);
+    free(dev);
+}
+
+static int load_baseline(const char *filename, result_t *baseline)
+{
+    char line[256];
+    int n = 0;
+    FILE *fh = fopen(filename, "r");
+
+    if (!fh) {
+        perror(filename);
+        exit(2);
+    }
+
+    while (n < MAX_CASES && fgets(line, sizeof line, fh)) {
+        if (line[0] == '#')
+            continue;
+
+        if (sscanf(line, "%63s %lf %lf", baseline[n].name, &baseline[n].median, &baseline[n].mad) == 3)
+            n++;
+    }
+
+    fclose(fh);
+    return n;
+}
+
+static void write_baseline(const char *filename, const result_t *results, int n, int runs)
+{
+    FILE *fh = fopen(filename, "w");
+
+    if (!fh) {
+        perror(filename);
+        exit(2);
+    }
+
+    fprintf(fh, "# csvbench baseline, %d runs, case median_mbs mad_mbs\n", runs);
+
+    for (int i = 0; i < n; i++)
+        fprintf(fh, "%s %.1f %.1f\n", results[i].name, results[i].median, results[i].mad);
+
+    fclose(fh);
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: csvbench [-r runs] [-t percent] [-b baseline | -w baseline]\n");
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    const char *compare = NULL;
+    const char *write = NULL;
+    int runs = 15;
+    double threshold = 10;
+    int c;
+
+    while ((c = getopt(argc, argv, "r:t:b:w:")) != -1) {
+        switch (c) {
+            case 'r': runs = atoi(optarg); break;
+            case 't': threshold = atof(optarg); break;
+            case 'b': compare = optarg; break;
+            case 'w': write = optarg; break;
+            default: usage();
+        }
+    }
+
+    if (optind != argc || runs < 1 || threshold < 0 || (compare && write))
+        usage();
+
+    result_t results[MAX_CASES];
+    result_t baseline[MAX_CASES];
+    int nbaseline = compare ? load_baseline(compare, baseline) : 0;
+    int n = 0;
+    int regressions = 0;
+    int missing = 0;
+
+    for (int i = 0; i < (int)(sizeof inputs / sizeof *inputs); i++)
+        generate(&inputs[i]);
+
+    printf("%-20s %10s %8s", "case", "MB/s", "MAD");
+    if (compare)
+        printf(" %10s %8s", "baseline", "change");
+    printf("\n");
+
+    for (int b = 0; b < (int)(sizeof benches / sizeof *benches); b++) {
+        for (int i = 0; i < (int)(sizeof inputs / sizeof *inputs); i++) {
+            result_t *result = &results[n++];
+
+            measure(&benches[b], &inputs[i], runs, result);
+            printf("%-20s %10.1f %8.1f", result->name, result->median, result->mad);
+
+            if (compare) {
+                const result_t *base = NULL;
+
+                for (int j = 0; j < nbaseline && !base; j++) {
+                    if (strcmp(baseline[j].name, result->name) == 0)
+                        base = &baseline[j];
+                }
+
+                if (base) {
+                    double change = (result->median - base->median) * 100 / base->median;
+                    // a drop within the spread of either run is noise, not a regression
+                    bool noise = base->median - result->median <= NOISE_MADS * (base->mad + result->mad);
+                    bool slower = change < -threshold;
+
+                    printf(" %10.1f %+7.1f%%%s", base->median, change, slower ? (noise ? "  noisy" : "  SLOWER") : "");
+                    regressions += slower && !noise;
+                } else {
+                    printf(" %10s %8s", "-", "new");
+                    missing++;
+                }
+            }
+
+            printf("\n");
+            fflush(stdout);
+        }
+    }
+
+    if (write)
+        write_baseline(write, results, n, runs);
+
+    for (int i = 0; i < (int)(sizeof inputs / sizeof *inputs); i++) {
+        unlink(inputs[i].path);
+        free(inputs[i].csv);
+        names_free(&inputs[i].names);
+    }
+
+    if (regressions) {
+        printf("\n%d of %d cases more than %.0f%% slower than %s\n", regressions, n, threshold, compare);
+        return 1;
+    }
+
+    if (missing)
+        printf("\n%d cases have no baseline, rewrite %s with -w\n", missing, compare);
+
+    return 0;
+}
@@ -0,0 +1,114 @@
+// The save and load loops shared by both plugins. Not a normal header: a
+// plugin defines its host adapter and includes this once, and gets its own
+// copy of the loops with the host calls expanded in place.
+//
+//   ENGINE_CHAR                            Character type of names in the host
+//   ENGINE_FIND(address, type, buf, len)   Name of type at address into buf,
+//                                          returns its length, 0 if none
+//   ENGINE_INSERT(address, type, name)     Queue a name to be added
+//   ENGINE_MERGE()                         Apply the queued names
+//   ENGINE_TO_UTF(src, len, dst, size)     Host name to UTF-8, optional
+//   ENGINE_FROM_UTF(src, len, dst, size)   UTF-8 to host name, optional
+//
+// Without the transcoders names are copied as they are.
+
+#ifndef ENGINE_CHAR
+#error "define the host adapter before including engine.h"
+#endif
+
+#ifndef ENGINE_TO_UTF
+#define ENGINE_TO_UTF(src, len, dst, size) engine_copy(dst, size, src, len)
+
+static inline void engine_copy(char *dst, size_t size, const char *src, size_t len)
+{
+    if (len >= size)
+        len = size - 1;
+    memcpy(dst, src, len);
+    dst[len] = '\0';
+}
+#endif
+
+typedef void (*engine_row_t)(void *data, unsigned int rva, int index, const char *name);
+
+// Asks the host for every type at every address of the module, from the top
+// down, and hands each name found to row with the index of its type
+static inline void engine_visit(unsigned int base, unsigned int size, const int *types, int ntypes, engine_row_t row, void *data)
+{
+    ENGINE_CHAR buffer[TEXTLEN];
+    char name[sizeof(((rva_t *)0)->name)];
+
+    STATS_ENTER(STATS_ENUMERATE);
+
+    // every address of the module, base + size - 1 down to base
+    for (unsigned int address = base + size; address-- > base; ) {
+        for (int i = 0; i < ntypes; i++) {
+            int len = ENGINE_FIND(address, types[i], buffer, TEXTLEN);
+
+            STATS_ADD(STATS_CALLS, 1);
+
+            if (len <= 0)
+                continue;
+
+            STATS_ENTER(STATS_UTF);
+            ENGINE_TO_UTF(buffer, len, name, sizeof(name));
+            STATS_LEAVE(STATS_UTF);
+            row(data, address - base, i, name);
+        }
+    }
+
+    STATS_LEAVE(STATS_ENUMERATE);
+}
+
+struct engine_collect_state {
+    const int *types;
+    rva_t *rvas;
+};
+
+static void engine_collect_row(void *data, unsigned int rva, int index, const char *name)
+{
+    struct engine_collect_state *s = data;
+    rva_t *item = malloc(sizeof(rva_t));
+
+    STATS_ADD(STATS_ALLOCS, 1);
+    item->address = rva;
+    item->raw_type = s->types[index];
+    strcpy(item->name, name);
+    LIST_INSERT(s->rvas, item);
+}
+
+// The names of the module as a list in address order, the prepending
+// LIST_INSERT reverses the visit
+static rva_t *engine_collect(unsigned int base, unsigned int size, const int *types, int ntypes)
+{
+    struct engine_collect_state s = { types, NULL };
+
+    engine_visit(base, size, types, ntypes, engine_collect_row, &s);
+
+    return s.rvas;
+}
+
+static inline void engine_insert(unsigned int address, int type, const char *name)
+{
+#ifdef ENGINE_FROM_UTF
+    ENGINE_CHAR text[TEXTLEN];
+
+    STATS_ENTER(STATS_UTF);
+    ENGINE_FROM_UTF(name, strlen(name), text, TEXTLEN);
+    STATS_LEAVE(STATS_UTF);
+#else
+    ENGINE_CHAR *text = (ENGINE_CHAR *)name;
+#endif
+
+    STATS_ENTER(STATS_APPLY);
+    ENGINE_INSERT(address, type, text);
+    STATS_LEAVE(STATS_APPLY);
+    STATS_ADD(STATS_CALLS, 1);
+}
+
+static inline void engine_merge(void)
+{
+    STATS_ENTER(STATS_APPLY);
+    ENGINE_MERGE();
+    STATS_LEAVE(STATS_APPLY);
+    STATS_ADD(STATS_CALLS, 1);
+}
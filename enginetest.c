@@ -0,0 +1,207 @@
+/*
+ * Copyright (c) 2013 Toni Spets <toni.spets@iki.fi>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Runs the loops of engine.h against a host made of a fixed name table, the
+ * way the plugins run them against OllyDbg. Checks which addresses and types
+ * are asked for, the order names are collected in, and that inserts and the
+ * merge reach the host unchanged.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "backup.h"
+#include "list.h"
+#include "stats.h"
+
+#define TEXTLEN     256
+
+#define BASE        0x1000
+#define SIZE        0x10
+
+typedef struct host_name_t {
+    unsigned int address;
+    int type;
+    const char *name;
+} host_name_t;
+
+static char long_name[300];
+
+static const host_name_t host[] = {
+    { BASE, 2, "at_base" },
+    { BASE + 3, 3, "not_asked_for" },
+    { BASE + 5, 1, "five_one" },
+    { BASE + 5, 2, "five_two" },
+    { BASE + 8, 1, long_name },
+    { BASE + SIZE - 1, 1, "last" },
+    { BASE + SIZE, 1, "past_the_end" },
+};
+
+static int finds = 0;
+static unsigned int lowest = 0xFFFFFFFF;
+static unsigned int highest = 0;
+
+static host_name_t inserted[8];
+static int ninserted = 0;
+static int merges = 0;
+
+static int host_find(unsigned int address, int type, char *buf, int len)
+{
+    finds++;
+
+    if (address < lowest)
+        lowest = address;
+    if (address > highest)
+        highest = address;
+
+    for (size_t i = 0; i < sizeof host / sizeof host[0]; i++) {
+        if (host[i].address == address && host[i].type == type) {
+            snprintf(buf, len, "%s", host[i].name);
+            return strlen(buf);
+        }
+    }
+
+    return 0;
+}
+
+static void host_insert(unsigned int address, int type, const char *name)
+{
+    if (ninserted < (int)(sizeof inserted / sizeof inserted[0]))
+        inserted[ninserted++] = (host_name_t){ address, type, name };
+}
+
+#define ENGINE_CHAR                             char
+#define ENGINE_FIND(address, type, buf, len)    host_find(address, type, buf, len)
+#define ENGINE_INSERT(address, type, name)      host_insert(address, type, name)
+#define ENGINE_MERGE()                          (merges++)
+#include "engine.h"
+
+static int failed = 0;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "enginetest.c:%d: %s\n", __LINE__, #cond); \
+        failed++; \
+    } \
+} while (0)
+
+typedef struct visit_t {
+    unsigned int rva[8];
+    int index[8];
+    int count;
+} visit_t;
+
+static void visit_row(void *data, unsigned int rva, int index, const char *name)
+{
+    visit_t *v = data;
+
+    if (v->count < 8) {
+        v->rva[v->count] = rva;
+        v->index[v->count] = index;
+    }
+
+    v->count++;
+}
+
+static void test_visit(void)
+{
+    const int types[] = { 1, 2 };
+    visit_t v = { { 0 } };
+
+    finds = 0;
+    lowest = 0xFFFFFFFF;
+    highest = 0;
+
+    engine_visit(BASE, SIZE, types, 2, visit_row, &v);
+
+    // every type at every address of the module and nothing outside it
+    CHECK(finds == SIZE * 2);
+    CHECK(lowest == BASE);
+    CHECK(highest == BASE + SIZE - 1);
+
+    // from the top down, the types of an address in list order
+    CHECK(v.count == 5);
+    CHECK(v.rva[0] == SIZE - 1 && v.index[0] == 0);
+    CHECK(v.rva[1] == 8 && v.index[1] == 0);
+    CHECK(v.rva[2] == 5 && v.index[2] == 0);
+    CHECK(v.rva[3] == 5 && v.index[3] == 1);
+    CHECK(v.rva[4] == 0 && v.index[4] == 1);
+}
+
+static void test_collect(void)
+{
+    const int types[] = { 1, 2 };
+    const struct { unsigned int address; int type; const char *name; } expect[] = {
+        { 0, 2, "at_base" },
+        { 5, 2, "five_two" },
+        { 5, 1, "five_one" },
+        { 8, 1, NULL },
+        { SIZE - 1, 1, "last" },
+    };
+    int n = 0;
+
+    rva_t *rvas = engine_collect(BASE, SIZE, types, 2);
+
+    // address order, the types of an address in reverse list order
+    LIST_FOREACH (rvas, rva_t, rva) {
+        if (n < (int)(sizeof expect / sizeof expect[0])) {
+            CHECK(rva->address == expect[n].address);
+            CHECK(rva->raw_type == expect[n].type);
+            if (expect[n].name)
+                CHECK(strcmp(rva->name, expect[n].name) == 0);
+            else
+                CHECK(strlen(rva->name) == sizeof rva->name - 1);
+        }
+        n++;
+    }
+
+    CHECK(n == (int)(sizeof expect / sizeof expect[0]));
+
+    LIST_FREE(rvas);
+}
+
+static void test_insert(void)
+{
+    ninserted = 0;
+    merges = 0;
+
+    engine_insert(BASE + 4, 1, "four");
+    engine_insert(BASE + 2, 2, "two");
+    engine_merge();
+
+    CHECK(ninserted == 2);
+    CHECK(inserted[0].address == BASE + 4 && inserted[0].type == 1 && strcmp(inserted[0].name, "four") == 0);
+    CHECK(inserted[1].address == BASE + 2 && inserted[1].type == 2 && strcmp(inserted[1].name, "two") == 0);
+    CHECK(merges == 1);
+}
+
+int main(void)
+{
+    memset(long_name, 'x', sizeof long_name - 1);
+
+    test_visit();
+    test_collect();
+    test_insert();
+
+    if (failed) {
+        fprintf(stderr, "%d checks failed\n", failed);
+        return 1;
+    }
+
+    printf("engine: all checks passed\n");
+    return 0;
+}
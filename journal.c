@@ -0,0 +1,301 @@
+/*
+ * Copyright (c) 2013 Toni Spets <toni.spets@iki.fi>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * The journal is a plain RVA,label_type,label CSV that only ever grows. Each
+ * row sets a name, a row with an empty name deletes it. Replaying the base
+ * snapshot, the journal being compacted and the live journal in that order
+ * gives the last known state, so a crash at any point loses nothing that
+ * was appended. Every file starts with the identity of the module build, and
+ * a clean close folds the journal into the base and removes it, so a journal
+ * found on open is only ever left behind by a crash.
+ */
+
+#include <windows.h>
+#include <stdio.h>
+#include "backup.h"
+#include "list.h"
+#include "journal.h"
+
+#define JOURNAL_COMPACT_SIZE    (1024 * 1024)
+
+static const char header[] = "RVA,label_type,label\r\n";
+
+static void write_header(FILE *fh, const identity_t *identity)
+{
+    fwrite(header, sizeof header - 1, 1, fh);
+    backup_write_identity(fh, identity);
+}
+
+// Adds the rows of a file of the build identity, -1 if it is of another one
+static int add_file(names_t *names, const char *filename, parse_type_t parse_type, const identity_t *identity)
+{
+    char message[1024];
+    identity_t saved;
+    rva_t *rvas = backup_load(filename, &saved, message);
+
+    if (rvas == NULL)
+        return 0;
+
+    if (!saved.size || backup_compare_identity(&saved, identity) != 0) {
+        LIST_FREE(rvas);
+        return -1;
+    }
+
+    // backup_load returns rows newest first, which is what the fold expects
+    LIST_FOREACH (rvas, rva_t, rva) {
+        int type = parse_type(rva->type);
+        if (type >= 0)
+            names_add(names, rva->address, type, rva->name);
+    }
+
+    LIST_FREE(rvas);
+    return 1;
+}
+
+// Folds a journal left behind into names, provided it was written for the
+// same build. Returns JOURNAL_NONE when there is nothing to replay.
+int journal_replay(const char *stem, parse_type_t parse_type, const identity_t *identity, names_t *names, char *message)
+{
+    char path[MAX_PATH];
+    names_t ops = { 0 };
+
+    sprintf(path, "%s.log", stem);
+    int log = add_file(&ops, path, parse_type, identity);
+
+    sprintf(path, "%s.log.old", stem);
+    int old = add_file(&ops, path, parse_type, identity);
+
+    if (log < 0 || old < 0) {
+        sprintf(message, "Journal %s.log was written for another build of the module, not replayed", stem);
+        names_free(&ops);
+        return JOURNAL_STALE;
+    }
+
+    if (!log && !old) {
+        names_free(&ops);
+        return JOURNAL_NONE;
+    }
+
+    sprintf(path, "%s.csv", stem);
+    if (add_file(&ops, path, parse_type, identity) < 0) {
+        sprintf(message, "Journal base %s was written for another build of the module, not replayed", path);
+        names_free(&ops);
+        return JOURNAL_STALE;
+    }
+
+    names_sort(&ops);
+
+    // equal keys are in insertion order, the first one is the newest
+    int deleted = 0;
+    for (int i = 0; i < ops.count; i++) {
+        if (i > 0 && ops.items[i].address == ops.items[i - 1].address && ops.items[i].type == ops.items[i - 1].type)
+            continue;
+
+        if (!NAMES_STR(&ops, i)[0])
+            deleted++;
+
+        names_add(names, ops.items[i].address, ops.items[i].type, NAMES_STR(&ops, i));
+    }
+
+    sprintf(message, "Replayed %d names and %d deletions from %s.log", names->count - deleted, deleted, stem);
+
+    names_free(&ops);
+    return JOURNAL_REPLAYED;
+}
+
+static bool write_base(const char *base, names_t *names, type_string_t type_string, const identity_t *identity)
+{
+    char tmp[MAX_PATH];
+    sprintf(tmp, "%s.tmp", base);
+
+    FILE *fh = fopen(tmp, "wb");
+    if (!fh)
+        return false;
+
+    write_header(fh, identity);
+
+    for (int i = 0; i < names->count; i++) {
+        if (NAMES_STR(names, i)[0])
+            backup_write_row(fh, names->items[i].address, type_string(names->items[i].type), NAMES_STR(names, i));
+    }
+
+    if (fclose(fh) != 0) {
+        DeleteFileA(tmp);
+        return false;
+    }
+
+    return backup_replace_file(tmp, base);
+}
+
+static DWORD WINAPI compact_worker(LPVOID param)
+{
+    journal_t *j = param;
+
+    // the old journal stays until the base that contains it is in place
+    if (write_base(j->base, &j->compacting, j->type_string, &j->identity))
+        DeleteFileA(j->old);
+
+    return 0;
+}
+
+static void reap_worker(journal_t *j, DWORD timeout)
+{
+    if (!j->worker || WaitForSingleObject(j->worker, timeout) != WAIT_OBJECT_0)
+        return;
+
+    CloseHandle(j->worker);
+    j->worker = NULL;
+
+    if (j->shared) {
+        memset(&j->compacting, 0, sizeof j->compacting);
+        j->shared = false;
+    } else {
+        names_free(&j->compacting);
+    }
+}
+
+static void compact(journal_t *j)
+{
+    if (!MoveFileExA(j->path, j->old, 0))
+        return;
+
+    j->compacting = j->state;
+    j->shared = true;
+    j->size = 0;
+
+    j->worker = CreateThread(NULL, 0, compact_worker, j, 0, NULL);
+
+    if (j->worker) {
+        SetThreadPriority(j->worker, THREAD_PRIORITY_LOWEST);
+    } else {
+        compact_worker(j);
+        memset(&j->compacting, 0, sizeof j->compacting);
+        j->shared = false;
+    }
+}
+
+bool journal_open(journal_t *j, const char *stem, type_string_t type_string, const identity_t *identity, names_t *live, char *message)
+{
+    memset(j, 0, sizeof *j);
+
+    sprintf(j->base, "%s.csv", stem);
+    sprintf(j->path, "%s.log", stem);
+    sprintf(j->old, "%s.log.old", stem);
+    j->type_string = type_string;
+    j->identity = *identity;
+
+    // start from a fresh base so nothing older than it needs replaying
+    if (!write_base(j->base, live, type_string, identity)) {
+        sprintf(message, "Failed to write journal base %s", j->base);
+        names_free(live);
+        return false;
+    }
+
+    DeleteFileA(j->old);
+
+    FILE *fh = fopen(j->path, "wb");
+    if (!fh) {
+        sprintf(message, "Failed to open %s for writing", j->path);
+        names_free(live);
+        return false;
+    }
+
+    write_header(fh, identity);
+    fclose(fh);
+
+    j->state = *live;
+    memset(live, 0, sizeof *live);
+
+    sprintf(message, "Journaling %d names to %s", j->state.count, j->path);
+    return true;
+}
+
+int journal_update(journal_t *j, names_t *live)
+{
+    names_t *old = &j->state;
+    FILE *fh = NULL;
+    int records = 0;
+    int i = 0, k = 0;
+
+    reap_worker(j, 0);
+
+    // sorted merge of the last known and the live set
+    while (i < old->count || k < live->count) {
+        name_t *a = i < old->count ? &old->items[i] : NULL;
+        name_t *b = k < live->count ? &live->items[k] : NULL;
+        const char *name;
+        name_t *row;
+
+        if (!b || (a && (a->address < b->address || (a->address == b->address && a->type < b->type)))) {
+            row = a, name = "";
+            i++;
+        } else if (!a || b->address < a->address || b->type < a->type) {
+            row = b, name = NAMES_STR(live, k);
+            k++;
+        } else {
+            name = NAMES_STR(live, k);
+            row = b;
+            i++, k++;
+            if (strcmp(NAMES_STR(old, i - 1), name) == 0)
+                continue;
+        }
+
+        if (!fh) {
+            fh = fopen(j->path, "ab");
+            if (!fh) {
+                names_free(live);
+                return -1;
+            }
+            if (ftell(fh) == 0)
+                write_header(fh, &j->identity);
+        }
+
+        j->size += backup_write_row(fh, row->address, j->type_string(row->type), name);
+        records++;
+    }
+
+    if (fh)
+        fclose(fh);
+
+    if (j->shared)
+        j->shared = false;
+    else
+        names_free(&j->state);
+
+    j->state = *live;
+    memset(live, 0, sizeof *live);
+
+    if (j->size > JOURNAL_COMPACT_SIZE && !j->worker)
+        compact(j);
+
+    return records;
+}
+
+// The last known state becomes the base and the journal goes away, it is
+// kept only if the base can't be written
+void journal_close(journal_t *j)
+{
+    reap_worker(j, INFINITE);
+
+    if (write_base(j->base, &j->state, j->type_string, &j->identity)) {
+        DeleteFileA(j->path);
+        DeleteFileA(j->old);
+    }
+
+    names_free(&j->state);
+    memset(j, 0, sizeof *j);
+}
@@ -0,0 +1,23 @@
+#include <stdbool.h>
+
+#define JOURNAL_STALE       -1      // Left behind for another build, not replayed
+#define JOURNAL_NONE        0
+#define JOURNAL_REPLAYED    1
+
+typedef struct journal_t {
+    char base[MAX_PATH];        // Compacted base snapshot
+    char path[MAX_PATH];        // Journal appended to since the base
+    char old[MAX_PATH];         // Journal being folded into a new base
+    type_string_t type_string;
+    identity_t identity;        // Build the journal is written for
+    names_t state;              // Last known name set, sorted
+    names_t compacting;         // Name set written by the worker
+    bool shared;                // state and compacting share buffers
+    long size;                  // Bytes appended since the base
+    HANDLE worker;
+} journal_t;
+
+int journal_replay(const char *stem, parse_type_t parse_type, const identity_t *identity, names_t *names, char *message);
+bool journal_open(journal_t *j, const char *stem, type_string_t type_string, const identity_t *identity, names_t *live, char *message);
+int journal_update(journal_t *j, names_t *live);
+void journal_close(journal_t *j);
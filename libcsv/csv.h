@@ -26,6 +26,9 @@ extern "C" {
                              field is quoted and doesn't containg ending 
                              quote */
 #define CSV_APPEND_NULL 8 /* Ensure that all fields are null-ternimated */
+#define CSV_VIEW 16     /* pass unquoted fields to cb1 as pointers into the
+                           input instead of copying them, such fields are
+                           not null-terminated and must not be modified */
 
 
 /* Character values */
@@ -53,6 +56,7 @@ struct csv_parser {
   void *(*malloc_func)(size_t);
   void *(*realloc_func)(void *, size_t);
   void (*free_func)(void *);
+  int entry_external; /* entry_buf was supplied by the caller, see csv_set_buffer */
 };
 
 /* Function Prototypes */
@@ -78,6 +82,7 @@ void csv_set_realloc_func(struct csv_parser *p, void *(*)(void *, size_t));
 void csv_set_free_func(struct csv_parser *p, void (*)(void *));
 void csv_set_blk_size(struct csv_parser *p, size_t);
 size_t csv_get_buffer_size(struct csv_parser *p);
+void csv_set_buffer(struct csv_parser *p, void *buf, size_t size);
 
 #ifdef __cplusplus
 }
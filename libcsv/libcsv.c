@@ -23,6 +23,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #  define SIZE_MAX ((size_t)-1) /* C89 doesn't have stdint.h or SIZE_MAX */
 #endif
 
+#include <string.h>
 #include "csv.h"
 
 #define VERSION "3.0.2"
@@ -48,12 +49,18 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
   do { \
    if (!quoted) \
      entry_pos -= spaces; \
-   if (p->options & CSV_APPEND_NULL) \
-     ((p)->entry_buf[entry_pos]) = '\0'; \
-   if (cb1) \
-     cb1(p->entry_buf, entry_pos, data); \
+   if (view) { \
+     if (cb1) \
+       cb1((void *)view, entry_pos, data); \
+   } else { \
+     if (p->options & CSV_APPEND_NULL) \
+       ((p)->entry_buf[entry_pos]) = '\0'; \
+     if (cb1) \
+       cb1(p->entry_buf, entry_pos, data); \
+   } \
    pstate = FIELD_NOT_BEGUN; \
    entry_pos = quoted = spaces = 0; \
+   view = NULL; \
  } while (0)
 
 #define SUBMIT_ROW(p, c) \
@@ -64,7 +71,8 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
     entry_pos = quoted = spaces = 0; \
   } while (0)
 
-#define SUBMIT_CHAR(p, c) ((p)->entry_buf[entry_pos++] = (c))
+/* A field that is viewed in place only needs its length counted */
+#define SUBMIT_CHAR(p, c) (view ? (void)entry_pos++ : (void)((p)->entry_buf[entry_pos++] = (c)))
 
 static char *csv_errors[] = {"success",
                              "error parsing data while strict checking enabled",
@@ -133,6 +141,7 @@ csv_init(struct csv_parser *p, unsigned char options)
   p->malloc_func = NULL;
   p->realloc_func = realloc;
   p->free_func = free;
+  p->entry_external = 0;
 
   return 0;
 }
@@ -144,11 +153,12 @@ csv_free(struct csv_parser *p)
   if (p == NULL)
     return;
 
-  if (p->entry_buf)
+  if (p->entry_buf && !p->entry_external)
     p->free_func(p->entry_buf);
 
   p->entry_buf = NULL;
   p->entry_size = 0;
+  p->entry_external = 0;
 
   return;
 }
@@ -161,6 +171,7 @@ csv_fini(struct csv_parser *p, void (*cb1)(void *, size_t, void *), void (*cb2)(
   int pstate = p->pstate;
   size_t spaces = p->spaces;
   size_t entry_pos = p->entry_pos;
+  const unsigned char *view = NULL;  /* csv_parse never leaves a field in view */
 
   if (p == NULL)
     return -1;
@@ -264,6 +275,25 @@ csv_get_buffer_size(struct csv_parser *p)
     return p->entry_size;
   return 0;
 }
+
+void
+csv_set_buffer(struct csv_parser *p, void *buf, size_t size)
+{
+  /* Use caller owned memory as the entry buffer.  The same buffer can be
+   * handed to any number of parsers in turn, csv_free leaves it alone.  If a
+   * field does not fit, the contents move to a buffer of our own.
+   */
+  if (p == NULL)
+    return;
+
+  csv_free(p);
+
+  if (buf && size) {
+    p->entry_buf = buf;
+    p->entry_size = size;
+    p->entry_external = 1;
+  }
+}
  
 static int
 csv_increase_buffer(struct csv_parser *p)
@@ -285,7 +315,7 @@ csv_increase_buffer(struct csv_parser *p)
     return -1;
   }
 
-  while ((vp = p->realloc_func(p->entry_buf, p->entry_size + to_add)) == NULL) {
+  while ((vp = p->realloc_func(p->entry_external ? NULL : p->entry_buf, p->entry_size + to_add)) == NULL) {
     to_add /= 2;
     if (!to_add) {
       p->status = CSV_ENOMEM;
@@ -293,12 +323,34 @@ csv_increase_buffer(struct csv_parser *p)
     }
   }
 
+  if (p->entry_external) {
+    memcpy(vp, p->entry_buf, p->entry_size);
+    p->entry_external = 0;
+  }
+
   /* Update entry buffer pointer and entry_size if successful */
   p->entry_buf = vp;
   p->entry_size += to_add;
   return 0;
 }
  
+static int
+csv_keep_view(struct csv_parser *p, const unsigned char *view, size_t *entry_pos)
+{
+  /* Copy the part of a viewed field seen so far into the entry buffer, for
+   * when the field goes on past the end of the input chunk.
+   */
+  while (*entry_pos >= p->entry_size) {
+    if (csv_increase_buffer(p) != 0) {
+      *entry_pos = 0;
+      return -1;
+    }
+  }
+
+  memcpy(p->entry_buf, view, *entry_pos);
+  return 0;
+}
+
 size_t
 csv_parse(struct csv_parser *p, const void *s, size_t len, void (*cb1)(void *, size_t, void *), void (*cb2)(int c, void *), void *data)
 {
@@ -315,6 +367,8 @@ csv_parse(struct csv_parser *p, const void *s, size_t len, void (*cb1)(void *, s
   int pstate = p->pstate;
   size_t spaces = p->spaces;
   size_t entry_pos = p->entry_pos;
+  const unsigned char *view = NULL;  /* Start of an unquoted field viewed in place */
+  int viewing = p->options & CSV_VIEW;
 
 
   if (!p->entry_buf && pos < len) {
@@ -327,7 +381,7 @@ csv_parse(struct csv_parser *p, const void *s, size_t len, void (*cb1)(void *, s
 
   while (pos < len) {
     /* Check memory usage, increase buffer if neccessary */
-    if (entry_pos == ((p->options & CSV_APPEND_NULL) ? p->entry_size - 1 : p->entry_size) ) {
+    if (!view && entry_pos == ((p->options & CSV_APPEND_NULL) ? p->entry_size - 1 : p->entry_size) ) {
       if (csv_increase_buffer(p) != 0) {
         p->quoted = quoted, p->pstate = pstate, p->spaces = spaces, p->entry_pos = entry_pos;
         return pos;
@@ -361,6 +415,8 @@ csv_parse(struct csv_parser *p, const void *s, size_t len, void (*cb1)(void *, s
         } else {               /* Anything else */
           pstate = FIELD_BEGUN;
           quoted = 0;
+          if (viewing)
+            view = us + pos - 1;
           SUBMIT_CHAR(p, c);
         }
         break;
@@ -372,6 +428,8 @@ csv_parse(struct csv_parser *p, const void *s, size_t len, void (*cb1)(void *, s
           } else {
             /* STRICT ERROR - double quote inside non-quoted field */
             if (p->options & CSV_STRICT) {
+              if (view)
+                csv_keep_view(p, view, &entry_pos);
               p->status = CSV_EPARSE;
               p->quoted = quoted, p->pstate = pstate, p->spaces = spaces, p->entry_pos = entry_pos;
               return pos-1;
@@ -442,6 +500,12 @@ csv_parse(struct csv_parser *p, const void *s, size_t len, void (*cb1)(void *, s
        break;
     }
   }
+
+  if (view && csv_keep_view(p, view, &entry_pos) != 0) {
+    p->quoted = quoted, p->pstate = pstate, p->spaces = spaces, p->entry_pos = entry_pos;
+    return pos;
+  }
+
   p->quoted = quoted, p->pstate = pstate, p->spaces = spaces, p->entry_pos = entry_pos;
   return pos;
 }
@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2013 Toni Spets <toni.spets@iki.fi>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Growable array of names with their strings in one pool. Only depends on
+ * the C library, the command line tools share it with the plugin.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "backup.h"
+
+bool names_add(names_t *names, unsigned int address, int type, const char *name)
+{
+    return names_add_n(names, address, type, name, strlen(name));
+}
+
+bool names_add_n(names_t *names, unsigned int address, int type, const char *name, size_t name_len)
+{
+    size_t len = name_len + 1;
+
+    if (names->count == names->capacity) {
+        int capacity = names->capacity ? names->capacity * 2 : 1024;
+        name_t *items = realloc(names->items, capacity * sizeof(name_t));
+        if (!items)
+            return false;
+        names->items = items;
+        names->capacity = capacity;
+    }
+
+    if (names->pool_used + len > names->pool_size) {
+        size_t pool_size = names->pool_size ? names->pool_size * 2 : 65536;
+        while (pool_size < names->pool_used + len)
+            pool_size *= 2;
+        char *pool = realloc(names->pool, pool_size);
+        if (!pool)
+            return false;
+        names->pool = pool;
+        names->pool_size = pool_size;
+    }
+
+    name_t *item = &names->items[names->count++];
+    item->address = address;
+    item->type = type;
+    item->name = names->pool_used;
+
+    memcpy(names->pool + names->pool_used, name, name_len);
+    names->pool[names->pool_used + name_len] = '\0';
+    names->pool_used += len;
+
+    return true;
+}
+
+static int names_cmp(const void *a, const void *b)
+{
+    const name_t *x = a;
+    const name_t *y = b;
+
+    if (x->address != y->address)
+        return x->address < y->address ? -1 : 1;
+
+    if (x->type != y->type)
+        return x->type < y->type ? -1 : 1;
+
+    // pool offsets grow with insertion order, which keeps equal keys stable
+    if (x->name != y->name)
+        return x->name < y->name ? -1 : 1;
+
+    return 0;
+}
+
+void names_sort(names_t *names)
+{
+    qsort(names->items, names->count, sizeof(name_t), names_cmp);
+}
+
+void names_free(names_t *names)
+{
+    free(names->items);
+    free(names->pool);
+    memset(names, 0, sizeof *names);
+}
@@ -0,0 +1,288 @@
+/*
+ * Copyright (c) 2013 Toni Spets <toni.spets@iki.fi>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Matches the procedures of two builds of a module by fingerprint. Both
+ * sides are sorted by hash once and walked together, so a match of two
+ * builds costs O(n log n) however many procedures they have. Procedures
+ * whose hash is found the same number of times on both sides are paired in
+ * address order, first by the full hash and then, for the rest, by shape.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "backup.h"
+#include "port.h"
+
+#define FINGERPRINTS_MAGIC      "UBFP"
+#define FINGERPRINTS_VERSION    1
+
+// 64-bit FNV-1a, 32 bits collide too often in a module of 100k procedures
+unsigned long long port_hash(unsigned long long hash, const void *data, size_t len)
+{
+    const unsigned char *p = data;
+
+    for (size_t i = 0; i < len; i++) {
+        hash ^= p[i];
+        hash *= 1099511628211ull;
+    }
+
+    return hash;
+}
+
+bool fingerprints_add(fingerprints_t *fp, unsigned int address, unsigned int size, unsigned long long hash, unsigned long long shape)
+{
+    if (fp->count == fp->capacity) {
+        int capacity = fp->capacity ? fp->capacity * 2 : 1024;
+        fingerprint_t *items = realloc(fp->items, capacity * sizeof(fingerprint_t));
+        if (!items)
+            return false;
+        fp->items = items;
+        fp->capacity = capacity;
+    }
+
+    fingerprint_t *item = &fp->items[fp->count++];
+    item->address = address;
+    item->size = size;
+    item->hash = hash;
+    item->shape = shape;
+
+    return true;
+}
+
+bool fingerprints_save(const char *filename, const fingerprints_t *fp, char *message)
+{
+    char tmp[260 + 4];
+    unsigned int version = FINGERPRINTS_VERSION;
+    unsigned int count = fp->count;
+
+    FILE *fh = backup_create(filename, tmp, sizeof tmp, message);
+    if (!fh)
+        return false;
+
+    bool ok = fwrite(FINGERPRINTS_MAGIC, 4, 1, fh) == 1
+        && fwrite(&version, sizeof version, 1, fh) == 1
+        && fwrite(fp->identity, sizeof fp->identity, 1, fh) == 1
+        && fwrite(&count, sizeof count, 1, fh) == 1
+        && (count == 0 || fwrite(fp->items, sizeof(fingerprint_t), count, fh) == count);
+
+    if (!backup_commit(fh, ok, tmp, filename)) {
+        sprintf(message, "Failed to write %s", filename);
+        return false;
+    }
+
+    sprintf(message, "Saved %d fingerprints to %s", fp->count, filename);
+    return true;
+}
+
+bool fingerprints_load(const char *filename, fingerprints_t *fp, char *message)
+{
+    char magic[4];
+    unsigned int version;
+    unsigned int count;
+
+    memset(fp, 0, sizeof *fp);
+
+    FILE *fh = fopen(filename, "rb");
+    if (!fh) {
+        sprintf(message, "Failed to open %s for reading", filename);
+        return false;
+    }
+
+    bool ok = fread(magic, 4, 1, fh) == 1 && memcmp(magic, FINGERPRINTS_MAGIC, 4) == 0
+        && fread(&version, sizeof version, 1, fh) == 1 && version == FINGERPRINTS_VERSION
+        && fread(fp->identity, sizeof fp->identity, 1, fh) == 1
+        && fread(&count, sizeof count, 1, fh) == 1
+        && count < 0x10000000;
+
+    if (ok && count) {
+        fp->items = malloc(count * sizeof(fingerprint_t));
+        ok = fp->items && fread(fp->items, sizeof(fingerprint_t), count, fh) == count;
+        fp->count = fp->capacity = count;
+    }
+
+    fp->identity[sizeof fp->identity - 1] = '\0';
+    fclose(fh);
+
+    if (!ok) {
+        fingerprints_free(fp);
+        sprintf(message, "%s is truncated or not a fingerprints file", filename);
+        return false;
+    }
+
+    return true;
+}
+
+void fingerprints_free(fingerprints_t *fp)
+{
+    free(fp->items);
+    fp->items = NULL;
+    fp->count = fp->capacity = 0;
+}
+
+typedef struct port_key_t {
+    unsigned long long key;
+    unsigned int address;
+    int index;
+} port_key_t;
+
+static int port_key_cmp(const void *a, const void *b)
+{
+    const port_key_t *x = a;
+    const port_key_t *y = b;
+
+    if (x->key != y->key)
+        return x->key < y->key ? -1 : 1;
+
+    return x->address < y->address ? -1 : x->address > y->address;
+}
+
+static int port_match_cmp(const void *a, const void *b)
+{
+    const port_match_t *x = a;
+    const port_match_t *y = b;
+
+    return x->from < y->from ? -1 : x->from > y->from;
+}
+
+// Sorted keys of the procedures not matched yet
+static port_key_t *port_keys(const fingerprints_t *fp, const bool *used, bool shape, int *n)
+{
+    port_key_t *keys = malloc((fp->count + 1) * sizeof(port_key_t));
+
+    *n = 0;
+
+    for (int i = 0; keys && i < fp->count; i++) {
+        if (used[i])
+            continue;
+
+        keys[*n].key = shape ? fp->items[i].shape : fp->items[i].hash;
+        keys[*n].address = fp->items[i].address;
+        keys[(*n)++].index = i;
+    }
+
+    if (keys)
+        qsort(keys, *n, sizeof(port_key_t), port_key_cmp);
+
+    return keys;
+}
+
+// One pass over both sides sorted by key, pairing runs of equal keys
+static int port_pass(const fingerprints_t *old, const fingerprints_t *new, bool *oldused, bool *newused, bool shape, port_match_t *matches, int n)
+{
+    int nold, nnew;
+    port_key_t *a = port_keys(old, oldused, shape, &nold);
+    port_key_t *b = port_keys(new, newused, shape, &nnew);
+    int i = 0;
+    int j = 0;
+
+    while (a && b && i < nold && j < nnew) {
+        if (a[i].key != b[j].key) {
+            if (a[i].key < b[j].key)
+                i++;
+            else
+                j++;
+            continue;
+        }
+
+        int ri = i;
+        int rj = j;
+
+        while (ri < nold && a[ri].key == a[i].key)
+            ri++;
+        while (rj < nnew && b[rj].key == b[j].key)
+            rj++;
+
+        // a different number of copies can't be told apart, leave them
+        if (ri - i == rj - j) {
+            int confidence = ri - i == 1 ? (shape ? PORT_SHAPE : PORT_EXACT) : (shape ? PORT_SHAPE_ORDER : PORT_EXACT_ORDER);
+
+            for (int k = 0; k < ri - i; k++) {
+                const fingerprint_t *from = &old->items[a[i + k].index];
+                const fingerprint_t *to = &new->items[b[j + k].index];
+
+                if (from->size != to->size)
+                    continue;
+
+                matches[n].from = from->address;
+                matches[n].to = to->address;
+                matches[n].size = from->size;
+                matches[n++].confidence = confidence;
+                oldused[a[i + k].index] = true;
+                newused[b[j + k].index] = true;
+            }
+        }
+
+        i = ri;
+        j = rj;
+    }
+
+    free(a);
+    free(b);
+
+    return n;
+}
+
+// Pairs the procedures of old with those of new, returns the number of
+// matches, sorted by their old address
+int port_match(const fingerprints_t *old, const fingerprints_t *new, port_match_t **matches)
+{
+    bool *oldused = calloc(old->count + 1, sizeof(bool));
+    bool *newused = calloc(new->count + 1, sizeof(bool));
+    int n = 0;
+
+    *matches = malloc((old->count + 1) * sizeof(port_match_t));
+
+    if (oldused && newused && *matches) {
+        n = port_pass(old, new, oldused, newused, false, *matches, n);
+        n = port_pass(old, new, oldused, newused, true, *matches, n);
+        qsort(*matches, n, sizeof(port_match_t), port_match_cmp);
+    }
+
+    free(oldused);
+    free(newused);
+
+    return n;
+}
+
+// New RVA of an old one inside a matched procedure. Matched procedures have
+// the same instruction lengths, so the offset carries over. Returns the
+// confidence, 0 if the address is not in any matched procedure.
+int port_address(const port_match_t *matches, int n, unsigned int from, unsigned int *to)
+{
+    int lo = 0;
+    int hi = n;
+
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (matches[mid].from <= from)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (lo == 0)
+        return 0;
+
+    const port_match_t *m = &matches[lo - 1];
+
+    if (from - m->from >= m->size)
+        return 0;
+
+    *to = m->to + (from - m->from);
+    return m->confidence;
+}
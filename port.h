@@ -0,0 +1,41 @@
+#include <stdbool.h>
+#include <stddef.h>
+
+#define PORT_EXACT          100     // Same bytes, found once in both builds
+#define PORT_EXACT_ORDER    80      // Same bytes, paired by address order
+#define PORT_SHAPE          60      // Same instructions, operands differ
+#define PORT_SHAPE_ORDER    40
+
+typedef struct fingerprint_t {
+    unsigned int address;       // RVA of the procedure
+    unsigned int size;
+    unsigned long long hash;    // Code with relocated operands and branch displacements masked
+    unsigned long long shape;   // Lengths and opcodes of the instructions only
+} fingerprint_t;
+
+// Procedure fingerprints of one build of a module, MODULE-fingerprints.bin
+typedef struct fingerprints_t {
+    char identity[64];
+    fingerprint_t *items;
+    int count;
+    int capacity;
+} fingerprints_t;
+
+typedef struct port_match_t {
+    unsigned int from;          // RVA of the procedure in the old build
+    unsigned int to;            // and in the new one
+    unsigned int size;
+    int confidence;             // PORT_xxx
+} port_match_t;
+
+#define PORT_HASH_INIT 14695981039346656037ull
+
+unsigned long long port_hash(unsigned long long hash, const void *data, size_t len);
+
+bool fingerprints_add(fingerprints_t *fp, unsigned int address, unsigned int size, unsigned long long hash, unsigned long long shape);
+bool fingerprints_save(const char *filename, const fingerprints_t *fp, char *message);
+bool fingerprints_load(const char *filename, fingerprints_t *fp, char *message);
+void fingerprints_free(fingerprints_t *fp);
+
+int port_match(const fingerprints_t *old, const fingerprints_t *new, port_match_t **matches);
+int port_address(const port_match_t *matches, int n, unsigned int from, unsigned int *to);
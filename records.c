@@ -0,0 +1,157 @@
+/*
+ * Copyright (c) 2013 Toni Spets <toni.spets@iki.fi>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Data records file: magic, version, module identity and record count, then
+ * per record its RVA (4 bytes), type (1), size (2) and the raw bytes. Like
+ * names_t the records keep their bytes in one growable pool.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "backup.h"
+#include "records.h"
+
+#define RECORDS_MAGIC       "UBDT"
+#define RECORDS_VERSION     1
+
+bool records_add(records_t *records, unsigned int address, int type, const void *data, size_t size)
+{
+    if (size > RECORD_MAX || type < 0 || type > 0xFF)
+        return false;
+
+    if (records->count == records->capacity) {
+        int capacity = records->capacity ? records->capacity * 2 : 256;
+        record_t *items = realloc(records->items, capacity * sizeof(record_t));
+        if (!items)
+            return false;
+        records->items = items;
+        records->capacity = capacity;
+    }
+
+    if (records->pool_used + size > records->pool_size) {
+        size_t pool_size = records->pool_size ? records->pool_size * 2 : 65536;
+        while (pool_size < records->pool_used + size)
+            pool_size *= 2;
+        unsigned char *pool = realloc(records->pool, pool_size);
+        if (!pool)
+            return false;
+        records->pool = pool;
+        records->pool_size = pool_size;
+    }
+
+    record_t *item = &records->items[records->count++];
+    item->address = address;
+    item->type = type;
+    item->size = size;
+    item->data = records->pool_used;
+
+    memcpy(records->pool + records->pool_used, data, size);
+    records->pool_used += size;
+
+    return true;
+}
+
+bool records_save(const char *filename, const records_t *records, char *message)
+{
+    char tmp[260 + 4];
+    unsigned int version = RECORDS_VERSION;
+    unsigned int count = records->count;
+
+    FILE *fh = backup_create(filename, tmp, sizeof tmp, message);
+    if (!fh)
+        return false;
+
+    bool ok = fwrite(RECORDS_MAGIC, 4, 1, fh) == 1
+        && fwrite(&version, sizeof version, 1, fh) == 1
+        && fwrite(records->identity, sizeof records->identity, 1, fh) == 1
+        && fwrite(&count, sizeof count, 1, fh) == 1;
+
+    for (int i = 0; ok && i < records->count; i++) {
+        const record_t *r = &records->items[i];
+        unsigned char type = r->type;
+        unsigned short size = r->size;
+
+        ok = fwrite(&r->address, sizeof r->address, 1, fh) == 1
+            && fwrite(&type, 1, 1, fh) == 1
+            && fwrite(&size, sizeof size, 1, fh) == 1
+            && (size == 0 || fwrite(RECORDS_DATA(records, i), size, 1, fh) == 1);
+    }
+
+    if (!backup_commit(fh, ok, tmp, filename)) {
+        sprintf(message, "Failed to write %s", filename);
+        return false;
+    }
+
+    sprintf(message, "Saved %d data records to %s", records->count, filename);
+    return true;
+}
+
+bool records_load(const char *filename, records_t *records, char *message)
+{
+    unsigned char data[RECORD_MAX];
+    char magic[4];
+    unsigned int version;
+    unsigned int count;
+
+    memset(records, 0, sizeof *records);
+
+    FILE *fh = fopen(filename, "rb");
+    if (!fh) {
+        sprintf(message, "Failed to open %s for reading", filename);
+        return false;
+    }
+
+    bool ok = fread(magic, 4, 1, fh) == 1 && memcmp(magic, RECORDS_MAGIC, 4) == 0
+        && fread(&version, sizeof version, 1, fh) == 1 && version == RECORDS_VERSION
+        && fread(records->identity, sizeof records->identity, 1, fh) == 1
+        && fread(&count, sizeof count, 1, fh) == 1;
+
+    records->identity[sizeof records->identity - 1] = '\0';
+
+    for (unsigned int i = 0; ok && i < count; i++) {
+        unsigned int address;
+        unsigned char type;
+        unsigned short size;
+
+        ok = fread(&address, sizeof address, 1, fh) == 1
+            && fread(&type, 1, 1, fh) == 1
+            && fread(&size, sizeof size, 1, fh) == 1
+            && (size == 0 || fread(data, size, 1, fh) == 1)
+            && records_add(records, address, type, data, size);
+    }
+
+    fclose(fh);
+
+    if (!ok) {
+        records_free(records);
+        sprintf(message, "%s is truncated or not a data records file", filename);
+        return false;
+    }
+
+    return true;
+}
+
+void records_free(records_t *records)
+{
+    free(records->items);
+    free(records->pool);
+    records->items = NULL;
+    records->pool = NULL;
+    records->count = records->capacity = 0;
+    records->pool_used = records->pool_size = 0;
+}
@@ -0,0 +1,29 @@
+#include <stdbool.h>
+#include <stddef.h>
+
+#define RECORD_MAX      65535       // Largest data record stored
+
+typedef struct record_t {
+    unsigned int address;       // RVA
+    int type;                   // DT_xxx
+    unsigned int size;
+    size_t data;                // offset of the bytes in records_t.pool
+} record_t;
+
+// Binary data records of one module, MODULE-data.bin
+typedef struct records_t {
+    char identity[64];          // backup_identity_string, empty if unknown
+    record_t *items;
+    int count;
+    int capacity;
+    unsigned char *pool;
+    size_t pool_used;
+    size_t pool_size;
+} records_t;
+
+#define RECORDS_DATA(records, i) ((records)->pool + (records)->items[i].data)
+
+bool records_add(records_t *records, unsigned int address, int type, const void *data, size_t size);
+bool records_save(const char *filename, const records_t *records, char *message);
+bool records_load(const char *filename, records_t *records, char *message);
+void records_free(records_t *records);
@@ -0,0 +1,337 @@
+/*
+ * Copyright (c) 2013 Toni Spets <toni.spets@iki.fi>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Thins out timestamped snapshots, MODULE-PROFILE-YYYYMMDD_HHMMSS.csv, by
+ * the rules of a retention_t. What to drop is decided from the catalog
+ * alone. Every snapshot is complete on its own, so dropping one never
+ * changes what the others restore. The files are deleted on a low priority
+ * thread; the catalog rows are dropped when the owner reaps the worker, so
+ * rows added by saves in the meantime are kept.
+ */
+
+#include <windows.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "catalog.h"
+#include "list.h"
+#include "retention.h"
+
+// Only files named with a save time are ever removed
+static bool timestamped(const char *file)
+{
+    size_t len = strlen(file);
+
+    if (len < 20 || strcmp(file + len - 4, ".csv") != 0 || file[len - 20] != '-')
+        return false;
+
+    const char *stamp = file + len - 19;
+
+    for (int i = 0; i < 15; i++) {
+        if (i == 8 ? stamp[i] != '_' : stamp[i] < '0' || stamp[i] > '9')
+            return false;
+    }
+
+    return true;
+}
+
+// Days since 1970-01-01 of a YYYY-MM-DD date
+static int day_number(const char *saved)
+{
+    int y = 1970, m = 1, d = 1;
+
+    sscanf(saved, "%d-%d-%d", &y, &m, &d);
+
+    y -= m <= 2;
+    int era = (y >= 0 ? y : y - 399) / 400;
+    int yoe = y - era * 400;
+    int doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+    return era * 146097 + doe - 719468;
+}
+
+bool retention_enabled(const retention_t *policy)
+{
+    return policy->latest || policy->hourly || policy->daily || policy->weekly || policy->cap;
+}
+
+typedef struct candidate_t {
+    catalog_t *entry;
+    int index;                  // position in the catalog
+    bool keep;
+} candidate_t;
+
+static int newest_first(const void *a, const void *b)
+{
+    const candidate_t *x = a;
+    const candidate_t *y = b;
+    int cmp = strcmp(y->entry->saved, x->entry->saved);
+
+    return cmp ? cmp : y->index - x->index;
+}
+
+// Keeps the newest snapshot of each of the last count buckets, a bucket
+// being the first len characters of the save time or the week
+static void keep_buckets(candidate_t *c, int n, const char *profile, int count, size_t len)
+{
+    const char *last = NULL;
+    int last_week = INT_MIN;
+    int kept = 0;
+
+    for (int i = 0; i < n && kept < count; i++) {
+        const char *saved = c[i].entry->saved;
+
+        if (strcmp(c[i].entry->profile, profile) != 0)
+            continue;
+
+        if (len) {
+            if (last && strncmp(last, saved, len) == 0)
+                continue;
+            last = saved;
+        } else {
+            // Monday based, 1970-01-01 was a Thursday
+            int week = (day_number(saved) + 3) / 7;
+            if (week == last_week)
+                continue;
+            last_week = week;
+        }
+
+        c[i].keep = true;
+        kept++;
+    }
+}
+
+// Marks the catalog entries to expire, returns how many
+int retention_select(catalog_t *entries, const retention_t *policy, bool *expire)
+{
+    int count = 0;
+    int n = 0;
+
+    LIST_FOREACH (entries, catalog_t, entry)
+        count++;
+
+    memset(expire, 0, count * sizeof(bool));
+
+    if (!retention_enabled(policy))
+        return 0;
+
+    candidate_t *c = calloc(count + 1, sizeof(candidate_t));
+    if (!c)
+        return 0;
+
+    int index = 0;
+
+    LIST_FOREACH (entries, catalog_t, entry) {
+        if (timestamped(entry->file)) {
+            c[n].entry = entry;
+            c[n].index = index;
+            n++;
+        }
+        index++;
+    }
+
+    qsort(c, n, sizeof(candidate_t), newest_first);
+
+    bool rules = policy->latest || policy->hourly || policy->daily || policy->weekly;
+
+    for (int i = 0; i < n; i++) {
+        const char *profile = c[i].entry->profile;
+        bool seen = false;
+
+        for (int j = 0; j < i && !seen; j++)
+            seen = strcmp(c[j].entry->profile, profile) == 0;
+
+        if (seen)
+            continue;
+
+        if (!rules) {
+            for (int j = i; j < n; j++)
+                c[j].keep = true;
+            break;
+        }
+
+        int latest = 0;
+        for (int j = i; j < n && latest < policy->latest; j++) {
+            if (strcmp(c[j].entry->profile, profile) == 0) {
+                c[j].keep = true;
+                latest++;
+            }
+        }
+
+        keep_buckets(c, n, profile, policy->hourly, 13);
+        keep_buckets(c, n, profile, policy->daily, 10);
+        keep_buckets(c, n, profile, policy->weekly, 0);
+    }
+
+    if (policy->cap) {
+        unsigned long long total = 0;
+        unsigned long long cap = (unsigned long long)policy->cap * 1024 * 1024;
+        bool *newest = calloc(n + 1, sizeof(bool));
+
+        if (!newest) {
+            free(c);
+            return 0;
+        }
+
+        // the newest kept snapshot of each profile stays whatever its size
+        for (int i = 0; i < n; i++) {
+            bool seen = false;
+
+            if (!c[i].keep)
+                continue;
+
+            for (int j = 0; j < i && !seen; j++)
+                seen = newest[j] && strcmp(c[j].entry->profile, c[i].entry->profile) == 0;
+
+            if (!seen) {
+                newest[i] = true;
+                total += c[i].entry->size;
+            }
+        }
+
+        // the others as long as they fit, newest first
+        for (int i = 0; i < n; i++) {
+            if (!c[i].keep || newest[i])
+                continue;
+
+            if (total + c[i].entry->size > cap)
+                c[i].keep = false;
+            else
+                total += c[i].entry->size;
+        }
+
+        free(newest);
+    }
+
+    int expired = 0;
+
+    for (int i = 0; i < n; i++) {
+        if (!c[i].keep) {
+            expire[c[i].index] = true;
+            expired++;
+        }
+    }
+
+    free(c);
+    return expired;
+}
+
+static bool delete_utf8(const char *path)
+{
+    wchar_t wide[MAX_PATH];
+
+    if (!MultiByteToWideChar(CP_UTF8, 0, path, -1, wide, MAX_PATH))
+        return false;
+
+    return DeleteFileW(wide) || GetLastError() == ERROR_FILE_NOT_FOUND;
+}
+
+static DWORD WINAPI retention_worker(LPVOID param)
+{
+    retention_job_t *job = param;
+    char message[1024];
+    char path[MAX_PATH + CATALOG_PATH];
+
+    catalog_t *entries = catalog_load(job->catalog, message);
+    if (!entries)
+        return 0;
+
+    int count = 0;
+    LIST_FOREACH (entries, catalog_t, entry)
+        count++;
+
+    bool *expire = calloc(count, sizeof(bool));
+
+    if (expire && retention_select(entries, &job->policy, expire)) {
+        const char *slash = strrchr(job->catalog, '\\');
+        int dir_len = slash ? (int)(slash - job->catalog) + 1 : 0;
+        int i = 0;
+
+        LIST_FOREACH (entries, catalog_t, entry) {
+            if (!expire[i++])
+                continue;
+
+            snprintf(path, sizeof path, "%.*s%s", dir_len, job->catalog, entry->file);
+
+            // the index goes first, an index without its snapshot is useless
+            size_t len = strlen(path);
+            if (len > 4) {
+                strcpy(path + len - 4, ".idx");
+                delete_utf8(path);
+                strcpy(path + len - 4, ".csv");
+            }
+
+            if (!delete_utf8(path))
+                continue;
+
+            catalog_t *expired = malloc(sizeof(catalog_t));
+            if (expired) {
+                *expired = *entry;
+                LIST_INSERT(job->expired, expired);
+            }
+        }
+    }
+
+    free(expire);
+    LIST_FREE(entries);
+    return 0;
+}
+
+bool retention_start(retention_job_t *job, const char *catalog, const retention_t *policy)
+{
+    if (job->worker || job->expired)
+        return false;
+
+    snprintf(job->catalog, sizeof job->catalog, "%s", catalog);
+    job->policy = *policy;
+
+    job->worker = CreateThread(NULL, 0, retention_worker, job, 0, NULL);
+
+    if (job->worker)
+        SetThreadPriority(job->worker, THREAD_PRIORITY_LOWEST);
+    else
+        retention_worker(job);
+
+    return true;
+}
+
+// Drops the catalog rows of the deleted snapshots once the worker is done.
+// Returns how many were removed, or -1 while the worker is still running.
+int retention_finish(retention_job_t *job, DWORD timeout, char *message)
+{
+    if (job->worker) {
+        if (WaitForSingleObject(job->worker, timeout) != WAIT_OBJECT_0)
+            return -1;
+
+        CloseHandle(job->worker);
+        job->worker = NULL;
+    }
+
+    int removed = 0;
+    LIST_FOREACH (job->expired, catalog_t, entry)
+        removed++;
+
+    if (removed) {
+        if (catalog_remove(job->catalog, job->expired, message))
+            sprintf(message, "Removed %d expired snapshots listed in %s", removed, job->catalog);
+    }
+
+    LIST_FREE(job->expired);
+    return removed;
+}
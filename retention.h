@@ -0,0 +1,26 @@
+#include <windows.h>
+#include <stdbool.h>
+#include "catalog.h"
+
+// Which timestamped snapshots to keep, zero turns a rule off. A snapshot
+// kept by any rule stays, the size cap then drops the oldest survivors that
+// don't fit but never the newest of a profile.
+typedef struct retention_t {
+    int latest;                 // Newest snapshots of each profile
+    int hourly;                 // Newest of each of the last hours with snapshots
+    int daily;                  // Same by day
+    int weekly;                 // Same by week, weeks start on Monday
+    unsigned int cap;           // Megabytes all timestamped snapshots may take
+} retention_t;
+
+typedef struct retention_job_t {
+    char catalog[MAX_PATH];
+    retention_t policy;
+    catalog_t *expired;         // Rows of the snapshots deleted by the worker
+    HANDLE worker;
+} retention_job_t;
+
+bool retention_enabled(const retention_t *policy);
+int retention_select(catalog_t *entries, const retention_t *policy, bool *expire);
+bool retention_start(retention_job_t *job, const char *catalog, const retention_t *policy);
+int retention_finish(retention_job_t *job, DWORD timeout, char *message);
@@ -0,0 +1,393 @@
+/*
+ * Copyright (c) 2013 Toni Spets <toni.spets@iki.fi>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Substring index over the names of a snapshot, kept next to it as .idx.
+ * The file holds the records in address order, their names in one pool and
+ * a suffix array over the pool, sorted ignoring ASCII case. A query is two
+ * binary searches for the range of suffixes that start with the pattern.
+ * Only depends on the C library, the command line tools share it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "backup.h"
+#include "search.h"
+
+#define SEARCH_MAGIC    0x58534255u     // "UBSX"
+#define SEARCH_VERSION  1
+
+typedef struct search_header_t {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t count;
+    uint32_t pool_size;         // padded to four bytes
+    uint32_t nsuffixes;
+} search_header_t;
+
+static inline unsigned int fold(unsigned char c)
+{
+    return c >= 'A' && c <= 'Z' ? c | 0x20 : c;
+}
+
+// First four folded bytes of a suffix, zero past its end
+static uint32_t prefix_key(const char *pool, uint32_t pos)
+{
+    uint32_t key = 0;
+
+    for (int i = 0; i < 4; i++) {
+        unsigned int c = fold(pool[pos]);
+        key = key << 8 | c;
+        if (c)
+            pos++;
+    }
+
+    return key;
+}
+
+typedef struct keyed_t {
+    uint32_t key;
+    uint32_t pos;
+} keyed_t;
+
+static int keyed_cmp(const void *a, const void *b)
+{
+    const keyed_t *x = a;
+    const keyed_t *y = b;
+
+    if (x->key != y->key)
+        return x->key < y->key ? -1 : 1;
+
+    return x->pos < y->pos ? -1 : x->pos > y->pos;
+}
+
+// Orders suffixes that share their first depth bytes by the next four,
+// going deeper for those that still tie
+static void sort_deeper(uint32_t *a, uint32_t n, const char *pool, uint32_t depth, keyed_t *work)
+{
+    for (uint32_t i = 0; i < n; i++) {
+        work[i].key = prefix_key(pool, a[i] + depth);
+        work[i].pos = a[i];
+    }
+
+    qsort(work, n, sizeof(keyed_t), keyed_cmp);
+
+    for (uint32_t i = 0; i < n; i++)
+        a[i] = work[i].pos;
+
+    for (uint32_t i = 0; i < n; ) {
+        uint32_t j = i + 1;
+
+        while (j < n && work[j].key == work[i].key)
+            j++;
+
+        // suffixes that end within the key are equal, pool order decides
+        if (j - i > 1 && (work[i].key & 0xFF))
+            sort_deeper(a + i, j - i, pool, depth + 4, work + i);
+
+        i = j;
+    }
+}
+
+// Radix sorts the suffixes on their first four bytes, which needs no access
+// to the pool, then settles the ties a few bytes at a time
+static bool sort_suffixes(uint32_t *a, uint32_t n, const char *pool)
+{
+    uint64_t *keys = malloc(n * sizeof(uint64_t) + 1);
+    uint64_t *swap = malloc(n * sizeof(uint64_t) + 1);
+
+    if (!keys || !swap) {
+        free(keys);
+        free(swap);
+        return false;
+    }
+
+    // positions start out ascending and the passes are stable, so equal
+    // keys stay in pool order
+    for (uint32_t i = 0; i < n; i++)
+        keys[i] = (uint64_t)prefix_key(pool, a[i]) << 32 | a[i];
+
+    for (int shift = 32; shift < 64; shift += 8) {
+        uint32_t count[257] = { 0 };
+
+        for (uint32_t i = 0; i < n; i++)
+            count[(keys[i] >> shift & 0xFF) + 1]++;
+        for (int b = 0; b < 256; b++)
+            count[b + 1] += count[b];
+        for (uint32_t i = 0; i < n; i++)
+            swap[count[keys[i] >> shift & 0xFF]++] = keys[i];
+
+        uint64_t *t = keys;
+        keys = swap;
+        swap = t;
+    }
+
+    for (uint32_t i = 0; i < n; i++)
+        a[i] = (uint32_t)keys[i];
+
+    for (uint32_t i = 0; i < n; ) {
+        uint32_t key = keys[i] >> 32;
+        uint32_t j = i + 1;
+
+        while (j < n && keys[j] >> 32 == key)
+            j++;
+
+        if (j - i > 1 && (key & 0xFF))
+            sort_deeper(a + i, j - i, pool, 4, (keyed_t *)swap + i);
+
+        i = j;
+    }
+
+    free(keys);
+    free(swap);
+    return true;
+}
+
+bool search_write(const char *filename, const names_t *names, char *message)
+{
+    search_header_t header = { SEARCH_MAGIC, SEARCH_VERSION, names->count, 0, 0 };
+    size_t pool_size = 0;
+
+    for (int i = 0; i < names->count; i++)
+        pool_size += strlen(NAMES_STR(names, i)) + 1;
+
+    pool_size = (pool_size + 3) & ~(size_t)3;
+
+    if (pool_size > UINT32_MAX) {
+        strcpy(message, "Too many names to index");
+        return false;
+    }
+
+    search_record_t *records = malloc(names->count * sizeof(search_record_t) + 1);
+    char *pool = calloc(1, pool_size + 1);
+    uint32_t *suffixes = malloc(pool_size * sizeof(uint32_t) + 1);
+
+    if (!records || !pool || !suffixes) {
+        free(records);
+        free(pool);
+        free(suffixes);
+        strcpy(message, "Out of memory while indexing");
+        return false;
+    }
+
+    // the pool is rebuilt in record order so a suffix maps back to its
+    // record with a binary search
+    uint32_t used = 0;
+    uint32_t n = 0;
+
+    for (int i = 0; i < names->count; i++) {
+        const char *name = NAMES_STR(names, i);
+        size_t len = strlen(name);
+
+        records[i].address = names->items[i].address;
+        records[i].type = names->items[i].type;
+        records[i].name = used;
+
+        memcpy(pool + used, name, len);
+        for (uint32_t k = 0; k < len; k++)
+            suffixes[n++] = used + k;
+        used += len + 1;
+    }
+
+    if (!sort_suffixes(suffixes, n, pool)) {
+        free(records);
+        free(pool);
+        free(suffixes);
+        strcpy(message, "Out of memory while indexing");
+        return false;
+    }
+
+    header.pool_size = pool_size;
+    header.nsuffixes = n;
+
+    // readers may have the old index open, it is only ever replaced whole
+    char tmp[FILENAME_MAX];
+    FILE *fh = backup_create(filename, tmp, sizeof tmp, message);
+    bool ret = fh != NULL;
+
+    if (ret) {
+        fwrite(&header, sizeof header, 1, fh);
+        fwrite(records, sizeof(search_record_t), names->count, fh);
+        fwrite(pool, 1, pool_size, fh);
+        fwrite(suffixes, sizeof(uint32_t), n, fh);
+        ret = backup_commit(fh, true, tmp, filename);
+    }
+
+    free(records);
+    free(pool);
+    free(suffixes);
+
+    if (!ret) {
+        sprintf(message, "Index %s could not be written", filename);
+        return false;
+    }
+
+    sprintf(message, "Indexed %d names to %s", names->count, filename);
+    return true;
+}
+
+bool search_open(search_t *s, const void *buf, size_t size)
+{
+    search_header_t header;
+
+    if (size < sizeof header)
+        return false;
+
+    memcpy(&header, buf, sizeof header);
+
+    if (header.magic != SEARCH_MAGIC || header.version != SEARCH_VERSION || header.pool_size % 4)
+        return false;
+
+    unsigned long long need = sizeof header + (unsigned long long)header.count * sizeof(search_record_t) +
+                              header.pool_size + (unsigned long long)header.nsuffixes * sizeof(uint32_t);
+
+    if (need > size || (header.count && header.pool_size == 0))
+        return false;
+
+    const char *p = (const char *)buf + sizeof header;
+
+    s->count = header.count;
+    s->pool_size = header.pool_size;
+    s->nsuffixes = header.nsuffixes;
+    s->records = (const search_record_t *)p;
+    s->pool = p + header.count * sizeof(search_record_t);
+    s->suffixes = (const uint32_t *)(s->pool + header.pool_size);
+
+    // every name, and so every suffix, must end inside the pool
+    if (header.pool_size && s->pool[header.pool_size - 1] != '\0')
+        return false;
+
+    // names start inside the pool in record order, which record_of relies on
+    for (uint32_t i = 0; i < header.count; i++) {
+        if (s->records[i].name >= header.pool_size || (i && s->records[i].name < s->records[i - 1].name))
+            return false;
+    }
+
+    for (uint32_t i = 0; i < header.nsuffixes; i++) {
+        if (s->suffixes[i] >= header.pool_size)
+            return false;
+    }
+
+    return true;
+}
+
+// Negative when the suffix sorts before the pattern, zero when it starts
+// with it
+static int prefix_cmp(const char *suffix, const char *pattern, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        unsigned int a = fold(suffix[i]);
+        unsigned int b = fold(pattern[i]);
+
+        if (a != b)
+            return a < b ? -1 : 1;
+    }
+
+    return 0;
+}
+
+static uint32_t record_of(const search_t *s, uint32_t pos)
+{
+    uint32_t lo = 0;
+    uint32_t hi = s->count;
+
+    while (hi - lo > 1) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (s->records[mid].name <= pos)
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+static int int_cmp(const void *a, const void *b)
+{
+    return *(const int *)a - *(const int *)b;
+}
+
+int search_find(const search_t *s, const char *pattern, int flags, int *results, int max, unsigned int *hits)
+{
+    size_t len = strlen(pattern);
+    uint32_t lo = 0;
+    uint32_t hi = s->nsuffixes;
+
+    if (hits)
+        *hits = 0;
+
+    if (len == 0 || s->count == 0 || max <= 0)
+        return 0;
+
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (s->suffixes[mid] < s->pool_size && prefix_cmp(s->pool + s->suffixes[mid], pattern, len) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    uint32_t first = lo;
+    hi = s->nsuffixes;
+
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (s->suffixes[mid] < s->pool_size && prefix_cmp(s->pool + s->suffixes[mid], pattern, len) <= 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (hits)
+        *hits = lo - first;
+
+    // a name can match more than once, report each record once
+    unsigned char *seen = calloc(s->count / 8 + 1, 1);
+    int found = 0;
+
+    if (!seen)
+        return 0;
+
+    for (uint32_t k = first; k < lo && found < max; k++) {
+        uint32_t pos = s->suffixes[k];
+        uint32_t rec = record_of(s, pos);
+
+        if ((flags & SEARCH_PREFIX) && s->records[rec].name != pos)
+            continue;
+
+        if (seen[rec / 8] & (1 << rec % 8))
+            continue;
+
+        seen[rec / 8] |= 1 << rec % 8;
+        results[found++] = rec;
+    }
+
+    free(seen);
+
+    qsort(results, found, sizeof(int), int_cmp);
+    return found;
+}
+
+void search_index_path(char *dst, size_t size, const char *snapshot)
+{
+    size_t len = strlen(snapshot);
+
+    if (len > 4 && strcmp(snapshot + len - 4, ".csv") == 0)
+        len -= 4;
+
+    snprintf(dst, size, "%.*s.idx", (int)len, snapshot);
+}
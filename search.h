@@ -0,0 +1,28 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SEARCH_PREFIX   1           // Match only at the start of a name
+
+typedef struct search_record_t {
+    uint32_t address;
+    uint32_t type;
+    uint32_t name;              // offset of the UTF-8 name in the pool
+} search_record_t;
+
+// An index opened over a buffer holding the whole .idx file
+typedef struct search_t {
+    uint32_t count;
+    uint32_t pool_size;
+    uint32_t nsuffixes;
+    const search_record_t *records;
+    const char *pool;
+    const uint32_t *suffixes;   // pool offsets sorted by the case folded suffix
+} search_t;
+
+#define SEARCH_STR(s, i) ((s)->pool + (s)->records[i].name)
+
+bool search_write(const char *filename, const names_t *names, char *message);
+bool search_open(search_t *s, const void *buf, size_t size);
+int search_find(const search_t *s, const char *pattern, int flags, int *results, int max, unsigned int *hits);
+void search_index_path(char *dst, size_t size, const char *snapshot);
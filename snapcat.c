@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2013 Toni Spets <toni.spets@iki.fi>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Lists the snapshots recorded in MODULE-catalog.csv files, optionally only
+ * those of a profile, a time range, a module build or with names of a type.
+ */
+
+#define _XOPEN_SOURCE 500
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "catalog.h"
+#include "list.h"
+
+static const char *profile = NULL;
+static const char *after = NULL;
+static const char *before = NULL;
+static const char *type = NULL;
+static const char *identity = NULL;
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: snapcat [-p profile] [-a after] [-b before] [-t type] [-i identity] catalog.csv...\n");
+    exit(2);
+}
+
+static bool wanted(const catalog_t *entry)
+{
+    // times compare as strings, so a prefix like 2013-06 works as a bound
+    if (profile && strcmp(entry->profile, profile) != 0)
+        return false;
+    if (after && strcmp(entry->saved, after) < 0)
+        return false;
+    if (before && strncmp(entry->saved, before, strlen(before)) > 0)
+        return false;
+    if (type && catalog_count(entry, type) == 0)
+        return false;
+    if (identity && strncmp(entry->identity, identity, strlen(identity)) != 0)
+        return false;
+
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    char message[1024];
+    int failed = 0;
+    int c;
+
+    while ((c = getopt(argc, argv, "p:a:b:t:i:")) != -1) {
+        switch (c) {
+            case 'p': profile = optarg; break;
+            case 'a': after = optarg; break;
+            case 'b': before = optarg; break;
+            case 't': type = optarg; break;
+            case 'i': identity = optarg; break;
+            default: usage();
+        }
+    }
+
+    if (optind == argc)
+        usage();
+
+    for (int i = optind; i < argc; i++) {
+        catalog_t *entries = catalog_load(argv[i], message);
+
+        if (!entries) {
+            fprintf(stderr, "%s\n", message);
+            failed++;
+            continue;
+        }
+
+        LIST_FOREACH (entries, catalog_t, entry) {
+            if (!wanted(entry))
+                continue;
+
+            printf("%s  %-10s %8d  %s  %s\n", entry->saved, entry->profile, entry->names,
+                   entry->identity[0] ? entry->identity : "-", entry->file);
+
+            if (type)
+                printf("    %s\n", entry->counts);
+        }
+
+        LIST_FREE(entries);
+    }
+
+    return failed ? 1 : 0;
+}
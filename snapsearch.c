@@ -0,0 +1,141 @@
+/*
+ * Copyright (c) 2013 Toni Spets <toni.spets@iki.fi>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Looks up names in the .idx files written next to snapshots by the plugin
+ * and udd2csv -i. Prints one CSV row per matching name, prefixed with the
+ * index it came from.
+ */
+
+#define _XOPEN_SOURCE 500
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "udd.h"
+#include "backup.h"
+#include "search.h"
+#include "libcsv/csv.h"
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: snapsearch [-p] [-n max] pattern file.idx...\n");
+    exit(2);
+}
+
+static int search_file(const char *path, const char *pattern, int flags, int *results, int max)
+{
+    struct stat st;
+    search_t s;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        return -1;
+    }
+
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        fprintf(stderr, "%s: empty file\n", path);
+        close(fd);
+        return -1;
+    }
+
+    void *buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (buf == MAP_FAILED) {
+        perror(path);
+        return -1;
+    }
+
+    if (!search_open(&s, buf, st.st_size)) {
+        fprintf(stderr, "%s: not a snapshot index\n", path);
+        munmap(buf, st.st_size);
+        return -1;
+    }
+
+    int found = search_find(&s, pattern, flags, results, max, NULL);
+
+    for (int i = 0; i < found; i++) {
+        const search_record_t *record = &s.records[results[i]];
+        const char *name = SEARCH_STR(&s, results[i]);
+        const char *type = udd_type_string(record->type);
+
+        printf("%s,%08X,%s,", path, record->address, type ? type : "");
+
+        if (strpbrk(name, ",\"\r\n"))
+            csv_fwrite(stdout, name, strlen(name));
+        else
+            fputs(name, stdout);
+
+        putchar('\n');
+    }
+
+    munmap(buf, st.st_size);
+    return found;
+}
+
+int main(int argc, char **argv)
+{
+    int flags = 0;
+    int max = 1000;
+    int c;
+
+    while ((c = getopt(argc, argv, "pn:")) != -1) {
+        switch (c) {
+            case 'p':
+                flags |= SEARCH_PREFIX;
+                break;
+            case 'n':
+                max = atoi(optarg);
+                if (max < 1)
+                    usage();
+                break;
+            default:
+                usage();
+        }
+    }
+
+    if (argc - optind < 2)
+        usage();
+
+    const char *pattern = argv[optind++];
+    int *results = malloc(max * sizeof(int));
+    int failed = 0;
+    int total = 0;
+
+    if (!results) {
+        perror("snapsearch");
+        return 1;
+    }
+
+    for (int i = optind; i < argc && total < max; i++) {
+        int found = search_file(argv[i], pattern, flags, results, max - total);
+
+        if (found < 0)
+            failed++;
+        else
+            total += found;
+    }
+
+    free(results);
+
+    return failed ? 1 : total ? 0 : 1;
+}
@@ -0,0 +1,674 @@
+/*
+ * Copyright (c) 2013 Toni Spets <toni.spets@iki.fi>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Reading and writing snapshot and archive CSV files. Rows are handed over
+ * as spans of the fields, and only the columns a header names are read.
+ * Only depends on the C library and libcsv, so the command line tools and
+ * csvbench run the same code as the plugin.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "backup.h"
+#include "list.h"
+#include "stats.h"
+#include "libcsv/csv.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+typedef void (*cb1)(void *, size_t, void *);
+typedef void (*cb2)(int, void *);
+
+typedef struct span_t {
+    const char *ptr;
+    size_t len;
+} span_t;
+
+typedef void (*row_t)(const span_t *field, int count, void *data);
+
+#define ROW_FIELDS  8
+#define ROW_SCRATCH 8192
+
+// Collects the fields of a row as spans and hands the whole row over at the
+// end of line. Fields are viewed in the read buffer where possible; quoted
+// ones and those still pending when a read ends are kept in the scratch.
+struct csv_row {
+    struct csv_parser *parser;
+    row_t row;
+    void *data;
+    int count;
+    unsigned int kept;          // bit set for each field that lives in scratch
+    span_t field[ROW_FIELDS];
+    size_t used;
+    char scratch[ROW_SCRATCH];
+};
+
+static const span_t empty_span = { "", 0 };
+
+#define ROW_FIELD(field, count, i) ((i) >= 0 && (i) < (count) ? &(field)[i] : &empty_span)
+
+static void row_keep(struct csv_row *r, int i)
+{
+    span_t *span = &r->field[i];
+    size_t len = span->len;
+
+    if (len > sizeof r->scratch - r->used)
+        len = sizeof r->scratch - r->used;
+
+    memcpy(r->scratch + r->used, span->ptr, len);
+    span->ptr = r->scratch + r->used;
+    span->len = len;
+    r->used += len;
+    r->kept |= 1u << i;
+}
+
+static void row_value(void *buf, size_t len, struct csv_row *r)
+{
+    if (r->count < ROW_FIELDS) {
+        r->field[r->count].ptr = buf;
+        r->field[r->count].len = len;
+
+        // the parser reuses its own buffer for the next field
+        if (buf == r->parser->entry_buf)
+            row_keep(r, r->count);
+    }
+
+    r->count++;
+}
+
+static void row_eol(int c, struct csv_row *r)
+{
+    r->row(r->field, r->count < ROW_FIELDS ? r->count : ROW_FIELDS, r->data);
+
+    r->count = 0;
+    r->kept = 0;
+    r->used = 0;
+}
+
+static void row_pin(struct csv_row *r)
+{
+    for (int i = 0; i < r->count && i < ROW_FIELDS; i++) {
+        if (!(r->kept & (1u << i)))
+            row_keep(r, i);
+    }
+}
+
+static bool span_eq(const span_t *span, const char *s)
+{
+    size_t len = strlen(s);
+    return span->len == len && memcmp(span->ptr, s, len) == 0;
+}
+
+static void span_str(char *dst, size_t size, const span_t *span)
+{
+    size_t len = span->len;
+
+    if (len > size - 1)
+        len = size - 1;
+    memcpy(dst, span->ptr, len);
+    dst[len] = '\0';
+}
+
+// Validated hex, at most eight digits and nothing else but an optional 0x
+// prefix, which older and hand edited files have
+static bool span_hex(const span_t *span, unsigned int *value)
+{
+    const char *p = span->ptr;
+    size_t len = span->len;
+    unsigned int v = 0;
+
+    if (len > 2 && p[0] == '0' && (p[1] | 0x20) == 'x') {
+        p += 2;
+        len -= 2;
+    }
+
+    if (len == 0 || len > 8)
+        return false;
+
+    for (size_t i = 0; i < len; i++) {
+        unsigned int c = (unsigned char)p[i];
+
+        if (c - '0' < 10) {
+            v = v << 4 | (c - '0');
+        } else if ((c | 0x20) - 'a' < 6) {
+            v = v << 4 | ((c | 0x20) - 'a' + 10);
+        } else {
+            return false;
+        }
+    }
+
+    *value = v;
+    return true;
+}
+
+// Maps each wanted column to its field index in the header row, -1 when the
+// header doesn't have it. Returns the number of columns found.
+static int compile_columns(const span_t *field, int count, const char *const *names, int n, int *map)
+{
+    int found = 0;
+
+    for (int i = 0; i < n; i++) {
+        map[i] = -1;
+        for (int j = 0; j < count; j++) {
+            if (span_eq(&field[j], names[i])) {
+                map[i] = j;
+                found++;
+                break;
+            }
+        }
+    }
+
+    return found;
+}
+
+// Fields are viewed straight in the read buffer, only quoted ones and those
+// split between two reads go through the arena. Indexes are built on a
+// worker while the main thread may load, so each load has its own buffers.
+#define LOAD_CHUNK  65536
+#define LOAD_ARENA  4096
+
+struct load_buffers {
+    char chunk[LOAD_CHUNK];
+    unsigned char arena[LOAD_ARENA];
+    struct csv_row r;
+};
+
+static bool parse_file(FILE *fh, row_t row, void *data)
+{
+    struct load_buffers *b = malloc(sizeof(struct load_buffers));
+    struct csv_row *r = b ? &b->r : NULL;
+    struct csv_parser p;
+    size_t len;
+
+    if (!b)
+        return false;
+
+    csv_init(&p, CSV_VIEW);
+    csv_set_buffer(&p, b->arena, sizeof b->arena);
+
+    r->parser = &p;
+    r->row = row;
+    r->data = data;
+    r->count = 0;
+    r->kept = 0;
+    r->used = 0;
+
+    for (;;) {
+        STATS_ENTER(STATS_IO);
+        len = fread(b->chunk, 1, sizeof b->chunk, fh);
+        STATS_LEAVE(STATS_IO);
+
+        if (len == 0)
+            break;
+
+        STATS_ADD(STATS_BYTES, len);
+        STATS_ENTER(STATS_CSV);
+        csv_parse(&p, b->chunk, len, (cb1)row_value, (cb2)row_eol, r);
+        // the next read overwrites whatever the pending row points to
+        row_pin(r);
+        STATS_LEAVE(STATS_CSV);
+    }
+
+    STATS_ENTER(STATS_CSV);
+    csv_fini(&p, (cb1)row_value, (cb2)row_eol, r);
+    csv_free(&p);
+    STATS_LEAVE(STATS_CSV);
+
+    free(b);
+    return true;
+}
+
+enum { COL_RVA, COL_LABEL, COL_COMMENT, RVA_COLUMNS };
+
+// Both layouts land in the label/comment slots of rva_t, which the 2.01
+// plugin reads back as type/name
+static const char *const rva_columns[][RVA_COLUMNS] = {
+    { "RVA", "label_type", "label" },
+    { "RVA", "label", "comment" },
+};
+
+struct load_data {
+    int map[RVA_COLUMNS];
+    int labels;
+    int comments;
+    int malformed;
+    rva_t *rvas;
+    identity_t *identity;
+};
+
+static void parse_identity(identity_t *identity, const span_t *key, const span_t *span)
+{
+    char value[16 + IDENTITY_SECTIONS * 9];
+
+    span_str(value, sizeof value, span);
+
+    if (span_eq(key, "size")) {
+        identity->size = strtoul(value, NULL, 16);
+    } else if (span_eq(key, "timestamp")) {
+        identity->timestamp = strtoul(value, NULL, 16);
+    } else if (span_eq(key, "crc")) {
+        identity->crc = strtoul(value, NULL, 16);
+    } else if (span_eq(key, "sections")) {
+        const char *p = value;
+        char *end;
+        identity->nsections = 0;
+        while (identity->nsections < IDENTITY_SECTIONS) {
+            unsigned int crc = strtoul(p, &end, 16);
+            if (end == p)
+                break;
+            identity->sections[identity->nsections++] = crc;
+            p = end;
+        }
+    }
+}
+
+static void load_row(const span_t *field, int count, struct load_data *data)
+{
+    if (span_eq(&field[0], "RVA")) {
+        for (int i = 0; i < (int)sizeof rva_columns / sizeof *rva_columns; i++) {
+            if (compile_columns(field, count, rva_columns[i], RVA_COLUMNS, data->map) == RVA_COLUMNS)
+                return;
+        }
+
+        // unknown header, fall back to the column order
+        for (int i = 0; i < RVA_COLUMNS; i++)
+            data->map[i] = i;
+        return;
+    }
+
+    const span_t *address = ROW_FIELD(field, count, data->map[COL_RVA]);
+    const span_t *label = ROW_FIELD(field, count, data->map[COL_LABEL]);
+    const span_t *comment = ROW_FIELD(field, count, data->map[COL_COMMENT]);
+    unsigned int rva;
+
+    if (span_eq(address, "IDENTITY")) {
+        if (data->identity)
+            parse_identity(data->identity, ROW_FIELD(field, count, 1), ROW_FIELD(field, count, 2));
+        return;
+    }
+
+    if (label->len == 0 && comment->len == 0)
+        return;
+
+    if (!span_hex(address, &rva)) {
+        data->malformed++;
+        return;
+    }
+
+    rva_t *rva_row = malloc(sizeof(rva_t));
+
+    STATS_ADD(STATS_ALLOCS, 1);
+    STATS_ADD(STATS_RECORDS, 1);
+
+    rva_row->address = rva;
+    span_str(rva_row->label, sizeof(rva_row->label), label);
+    span_str(rva_row->comment, sizeof(rva_row->comment), comment);
+
+    LIST_INSERT(data->rvas, rva_row);
+
+    if (label->len)
+        data->labels++;
+
+    if (comment->len)
+        data->comments++;
+}
+
+rva_t *backup_load(const char *filename, identity_t *identity, char *message)
+{
+    struct load_data data;
+
+    memset(&data, 0, sizeof data);
+    data.identity = identity;
+
+    // files without a header are read in the column order
+    for (int i = 0; i < RVA_COLUMNS; i++)
+        data.map[i] = i;
+
+    if (identity)
+        memset(identity, 0, sizeof *identity);
+
+    FILE *fh = fopen(filename, "rb");
+    if (!fh) {
+        sprintf(message, "Failed to open %s for reading", filename);
+        return NULL;
+    }
+
+    bool parsed = parse_file(fh, (row_t)load_row, &data);
+
+    fclose(fh);
+
+    if (!parsed) {
+        sprintf(message, "Out of memory while reading %s", filename);
+        return NULL;
+    }
+
+    if (data.rvas == NULL)
+    {
+        if (data.malformed)
+            sprintf(message, "File %s didn't have any valid rows, %d malformed", filename, data.malformed);
+        else
+            sprintf(message, "File %s didn't have any labels or comments", filename);
+        return NULL;
+    }
+
+    int len = sprintf(message, "Loaded %d labels and %d comments from %s", data.labels, data.comments, filename);
+    if (data.malformed)
+        sprintf(message + len, ", skipped %d malformed rows", data.malformed);
+
+    return data.rvas;
+}
+
+unsigned int backup_hash(unsigned int hash, const void *data, size_t len)
+{
+    const unsigned char *p = data;
+
+    // FNV-1a, cheap enough to run over every name on a debugger event
+    while (len--) {
+        hash ^= *p++;
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+int backup_write_row(FILE *fh, unsigned int address, const char *type, const char *name)
+{
+    size_t type_len = strlen(type);
+    size_t name_len = strlen(name);
+
+    fprintf(fh, "%08X,", address);
+    fwrite(type, type_len, 1, fh);
+    fwrite(",", 1, 1, fh);
+
+    if (strpbrk(name, ",\"\r\n"))
+        csv_fwrite(fh, name, name_len);
+    else
+        fwrite(name, name_len, 1, fh);
+
+    fwrite("\r\n", 2, 1, fh);
+
+    return 8 + 1 + type_len + 1 + name_len + 2;
+}
+
+bool backup_replace_file(const char *from, const char *to)
+{
+#ifdef _WIN32
+    return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+#else
+    return rename(from, to) == 0;
+#endif
+}
+
+/*
+ * Files that others may read while they are saved are written to FILE.tmp,
+ * which replaces FILE only once it is complete. Readers see either the old
+ * or the new file whole.
+ */
+
+FILE *backup_create(const char *filename, char *tmp, size_t size, char *message)
+{
+    if (snprintf(tmp, size, "%s.tmp", filename) >= (int)size) {
+        sprintf(message, "Path too long: %s", filename);
+        return NULL;
+    }
+
+    FILE *fh = fopen(tmp, "wb");
+    if (!fh)
+        sprintf(message, "File %s could not be opened for writing", tmp);
+
+    return fh;
+}
+
+// Closes a file from backup_create and moves it over filename if ok, the
+// temporary file is removed on any failure
+bool backup_commit(FILE *fh, bool ok, const char *tmp, const char *filename)
+{
+    if (fclose(fh) == 0 && ok && backup_replace_file(tmp, filename))
+        return true;
+
+    remove(tmp);
+    return false;
+}
+
+/*
+ * An archive holds the names of several modules in one CSV. It starts with
+ * an index of the modules followed by the names, each section introduced
+ * by its own header row:
+ *
+ *   module,base,size,identity
+ *   module,RVA,label_type,label
+ */
+
+static void csv_write_field(FILE *fh, const char *s)
+{
+    if (strpbrk(s, ",\"\r\n"))
+        csv_fwrite(fh, s, strlen(s));
+    else
+        fwrite(s, strlen(s), 1, fh);
+}
+
+bool backup_save_archive(const char *filename, archive_t *modules, type_string_t type_string, char *message)
+{
+    if (!modules) {
+        strcpy(message, "Nothing to save");
+        return false;
+    }
+
+    FILE *fh = fopen(filename, "wb");
+
+    if (!fh) {
+        sprintf(message, "File %s could not be opened for writing", filename);
+        return false;
+    }
+
+    int count = 0;
+    int names = 0;
+
+    fprintf(fh, "module,base,size,identity\r\n");
+
+    LIST_FOREACH (modules, archive_t, m) {
+        csv_write_field(fh, m->module);
+        fprintf(fh, ",%08X,%08X,", m->base, m->size);
+        csv_write_field(fh, m->identity);
+        fwrite("\r\n", 2, 1, fh);
+        count++;
+    }
+
+    fprintf(fh, "module,RVA,label_type,label\r\n");
+
+    LIST_FOREACH (modules, archive_t, m) {
+        for (int i = 0; i < m->names.count; i++) {
+            csv_write_field(fh, m->module);
+            fwrite(",", 1, 1, fh);
+            backup_write_row(fh, m->names.items[i].address, type_string(m->names.items[i].type), NAMES_STR(&m->names, i));
+            names++;
+        }
+    }
+
+    fclose(fh);
+
+    sprintf(message, "Saved %d names of %d modules to %s", names, count, filename);
+    return true;
+}
+
+enum { ARC_MODULE, ARC_BASE, ARC_SIZE, ARC_IDENTITY, INDEX_COLUMNS };
+enum { ARC_RVA = 1, ARC_TYPE, ARC_NAME, NAME_COLUMNS };
+
+static const char *const index_columns[INDEX_COLUMNS] = { "module", "base", "size", "identity" };
+static const char *const name_columns[NAME_COLUMNS] = { "module", "RVA", "label_type", "label" };
+
+struct archive_data {
+    int section;                // 0 before any header, 1 index, 2 names
+    int map[4];                 // columns of the current section
+    archive_t *modules;
+    archive_t *last;
+    parse_type_t parse_type;
+    int names;
+    int malformed;
+};
+
+static void archive_row(const span_t *field, int count, struct archive_data *data)
+{
+    if (span_eq(&field[0], "module")) {
+        // the identity column is optional in the index
+        compile_columns(field, count, index_columns, INDEX_COLUMNS, data->map);
+
+        if (data->map[ARC_BASE] >= 0 && data->map[ARC_SIZE] >= 0) {
+            data->section = 1;
+        } else if (compile_columns(field, count, name_columns, NAME_COLUMNS, data->map) == NAME_COLUMNS) {
+            data->section = 2;
+        } else {
+            data->section = 0;
+        }
+        return;
+    }
+
+    const span_t *module = ROW_FIELD(field, count, data->map[ARC_MODULE]);
+
+    if (data->section == 1) {
+        unsigned int base, size;
+
+        if (!span_hex(ROW_FIELD(field, count, data->map[ARC_BASE]), &base) ||
+            !span_hex(ROW_FIELD(field, count, data->map[ARC_SIZE]), &size)) {
+            data->malformed++;
+            return;
+        }
+
+        archive_t *m = LIST_ALLOC(archive_t);
+        span_str(m->module, sizeof m->module, module);
+        m->base = base;
+        m->size = size;
+        span_str(m->identity, sizeof m->identity, ROW_FIELD(field, count, data->map[ARC_IDENTITY]));
+        LIST_INSERT(data->modules, m);
+    } else if (data->section == 2) {
+        const span_t *name = ROW_FIELD(field, count, data->map[ARC_NAME]);
+        char type_string[64];
+        unsigned int rva;
+
+        if (name->len == 0)
+            return;
+
+        if (!span_hex(ROW_FIELD(field, count, data->map[ARC_RVA]), &rva)) {
+            data->malformed++;
+            return;
+        }
+
+        // rows are grouped by module, so the last match is usually right
+        if (!data->last || !span_eq(module, data->last->module)) {
+            data->last = NULL;
+            LIST_FOREACH (data->modules, archive_t, m) {
+                if (span_eq(module, m->module)) {
+                    data->last = m;
+                    break;
+                }
+            }
+        }
+
+        span_str(type_string, sizeof type_string, ROW_FIELD(field, count, data->map[ARC_TYPE]));
+        int type = data->parse_type(type_string);
+
+        if (data->last && type >= 0) {
+            names_add_n(&data->last->names, rva, type, name->ptr, name->len);
+            data->names++;
+        }
+    }
+}
+
+archive_t *backup_load_archive(const char *filename, parse_type_t parse_type, char *message)
+{
+    struct archive_data *data;
+
+    FILE *fh = fopen(filename, "rb");
+    if (!fh) {
+        sprintf(message, "Failed to open %s for reading", filename);
+        return NULL;
+    }
+
+    data = calloc(1, sizeof *data);
+    data->parse_type = parse_type;
+
+    bool parsed = parse_file(fh, (row_t)archive_row, data);
+
+    fclose(fh);
+
+    archive_t *modules = data->modules;
+
+    if (!parsed) {
+        sprintf(message, "Out of memory while reading %s", filename);
+    } else if (modules == NULL) {
+        sprintf(message, "File %s didn't have a module index", filename);
+    } else {
+        int len = sprintf(message, "Loaded %d names from %s", data->names, filename);
+        if (data->malformed)
+            sprintf(message + len, ", skipped %d malformed rows", data->malformed);
+    }
+
+    free(data);
+    return modules;
+}
+
+void backup_free_archive(archive_t *modules)
+{
+    LIST_FOREACH (modules, archive_t, m) {
+        names_free(&m->names);
+    }
+
+    LIST_FREE(modules);
+}
+
+// Reads only the identity rows at the top of a snapshot, false if it has none
+bool backup_read_identity(const char *filename, identity_t *identity)
+{
+    char line[256];
+
+    memset(identity, 0, sizeof *identity);
+
+    FILE *fh = fopen(filename, "rb");
+    if (!fh)
+        return false;
+
+    while (fgets(line, sizeof line, fh)) {
+        if (strncmp(line, "RVA,", 4) == 0)
+            continue;
+
+        char *value = strncmp(line, "IDENTITY,", 9) == 0 ? strchr(line + 9, ',') : NULL;
+        if (!value)
+            break;
+
+        span_t key = { line + 9, value - (line + 9) };
+        span_t span = { value + 1, strcspn(value + 1, "\r\n") };
+        parse_identity(identity, &key, &span);
+    }
+
+    fclose(fh);
+    return identity->size != 0;
+}
+
+void backup_write_identity(FILE *fh, const identity_t *identity)
+{
+    fprintf(fh, "IDENTITY,size,%08X\r\n", identity->size);
+    fprintf(fh, "IDENTITY,timestamp,%08X\r\n", identity->timestamp);
+    fprintf(fh, "IDENTITY,crc,%08X\r\n", identity->crc);
+
+    fprintf(fh, "IDENTITY,sections,");
+    for (int i = 0; i < identity->nsections; i++)
+        fprintf(fh, i ? " %08X" : "%08X", identity->sections[i]);
+    fwrite("\r\n", 2, 1, fh);
+}
@@ -0,0 +1,275 @@
+/*
+ * Copyright (c) 2013 Toni Spets <toni.spets@iki.fi>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * External sort of names. Names are collected in a names_t until it holds
+ * half of the budget, so that the doubling of its arrays stays within it,
+ * then sorted and written out as a run: address, type, name length and the
+ * name, one record after another. Reading back merges the runs through a
+ * binary heap, each run read through its share of the budget. Names that
+ * compare equal come out in the order they were added, as names_sort
+ * keeps them.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "backup.h"
+#include "spill.h"
+
+#define SPILL_MINBUFFER     4096
+#define SPILL_MAXNAME       1023    // Longer names are cut, OllyDbg's are far shorter
+
+typedef struct spill_run_t {
+    FILE *fh;
+    char *buffer;
+    unsigned int address;
+    int type;
+    char name[SPILL_MAXNAME + 1];
+} spill_run_t;
+
+static void spill_path(const spill_t *spill, int run, char *path, size_t size)
+{
+    snprintf(path, size, "%s.run%d", spill->base, run);
+}
+
+void spill_init(spill_t *spill, const char *base, size_t budget)
+{
+    memset(spill, 0, sizeof *spill);
+    snprintf(spill->base, sizeof spill->base, "%s", base);
+    spill->budget = budget;
+}
+
+static size_t spill_used(const spill_t *spill)
+{
+    return spill->names.count * sizeof(name_t) + spill->names.pool_used;
+}
+
+static bool spill_run(spill_t *spill, char *message)
+{
+    char path[260 + 16];
+    names_t *names = &spill->names;
+
+    if (spill->runs == SPILL_MAXRUNS) {
+        sprintf(message, "More than %d runs needed, raise the memory budget", SPILL_MAXRUNS);
+        return false;
+    }
+
+    spill_path(spill, spill->runs, path, sizeof path);
+
+    FILE *fh = fopen(path, "wb");
+    if (!fh) {
+        sprintf(message, "File %s could not be opened for writing", path);
+        return false;
+    }
+
+    names_sort(names);
+
+    bool ok = true;
+
+    for (int i = 0; ok && i < names->count; i++) {
+        const char *name = NAMES_STR(names, i);
+        unsigned short len = strlen(name);
+
+        ok = fwrite(&names->items[i].address, sizeof(unsigned int), 1, fh) == 1
+            && fwrite(&names->items[i].type, sizeof(int), 1, fh) == 1
+            && fwrite(&len, sizeof len, 1, fh) == 1
+            && (len == 0 || fwrite(name, len, 1, fh) == 1);
+    }
+
+    if (fclose(fh) != 0 || !ok) {
+        remove(path);
+        sprintf(message, "Failed to write %s", path);
+        return false;
+    }
+
+    spill->runs++;
+
+    // the arrays are kept for the next run
+    names->count = 0;
+    names->pool_used = 0;
+
+    return true;
+}
+
+bool spill_add(spill_t *spill, unsigned int address, int type, const char *name, char *message)
+{
+    size_t len = strlen(name);
+
+    if (len > SPILL_MAXNAME)
+        len = SPILL_MAXNAME;
+
+    if (!names_add_n(&spill->names, address, type, name, len)) {
+        strcpy(message, "Out of memory");
+        return false;
+    }
+
+    if (spill_used(spill) >= spill->budget / 2)
+        return spill_run(spill, message);
+
+    return true;
+}
+
+static bool spill_read(spill_run_t *run)
+{
+    unsigned short len;
+
+    if (fread(&run->address, sizeof run->address, 1, run->fh) != 1
+        || fread(&run->type, sizeof run->type, 1, run->fh) != 1
+        || fread(&len, sizeof len, 1, run->fh) != 1
+        || (len && fread(run->name, len, 1, run->fh) != 1))
+        return false;
+
+    run->name[len] = '\0';
+    return true;
+}
+
+// Earlier runs hold names added earlier, they go first on equal keys
+static bool spill_less(spill_run_t **heap, int a, int b)
+{
+    const spill_run_t *x = heap[a];
+    const spill_run_t *y = heap[b];
+
+    if (x->address != y->address)
+        return x->address < y->address;
+
+    if (x->type != y->type)
+        return x->type < y->type;
+
+    return x < y;
+}
+
+static void spill_sift(spill_run_t **heap, int n, int i)
+{
+    for (;;) {
+        int least = i;
+        int left = 2 * i + 1;
+        int right = left + 1;
+
+        if (left < n && spill_less(heap, left, least))
+            least = left;
+        if (right < n && spill_less(heap, right, least))
+            least = right;
+
+        if (least == i)
+            return;
+
+        spill_run_t *tmp = heap[i];
+        heap[i] = heap[least];
+        heap[least] = tmp;
+        i = least;
+    }
+}
+
+// Hands every name to row in sorted order and removes the run files
+bool spill_finish(spill_t *spill, spill_row_t row, void *data, char *message)
+{
+    names_t *names = &spill->names;
+
+    if (spill->runs == 0) {
+        names_sort(names);
+
+        for (int i = 0; i < names->count; i++)
+            row(data, names->items[i].address, names->items[i].type, NAMES_STR(names, i));
+
+        names_free(names);
+        return true;
+    }
+
+    if (names->count && !spill_run(spill, message)) {
+        spill_free(spill);
+        return false;
+    }
+
+    // the merge gets the whole budget for its buffers
+    names_free(names);
+
+    size_t share = spill->budget / (spill->runs + 1);
+    if (share < SPILL_MINBUFFER)
+        share = SPILL_MINBUFFER;
+
+    spill_run_t *runs = calloc(spill->runs, sizeof(spill_run_t));
+    spill_run_t **heap = calloc(spill->runs, sizeof(spill_run_t *));
+    bool ok = runs && heap;
+    int n = 0;
+
+    for (int i = 0; ok && i < spill->runs; i++) {
+        char path[260 + 16];
+
+        spill_path(spill, i, path, sizeof path);
+
+        runs[i].fh = fopen(path, "rb");
+        runs[i].buffer = malloc(share);
+
+        if (!runs[i].fh || !runs[i].buffer) {
+            sprintf(message, "Failed to open %s for reading", path);
+            ok = false;
+            break;
+        }
+
+        setvbuf(runs[i].fh, runs[i].buffer, _IOFBF, share);
+
+        if (spill_read(&runs[i]))
+            heap[n++] = &runs[i];
+    }
+
+    for (int i = n / 2 - 1; ok && i >= 0; i--)
+        spill_sift(heap, n, i);
+
+    while (ok && n > 0) {
+        spill_run_t *run = heap[0];
+
+        row(data, run->address, run->type, run->name);
+
+        if (!spill_read(run)) {
+            if (!feof(run->fh)) {
+                sprintf(message, "Failed to read run %d of %s", (int)(run - runs), spill->base);
+                ok = false;
+            }
+            heap[0] = heap[--n];
+        }
+
+        spill_sift(heap, n, 0);
+    }
+
+    for (int i = 0; runs && i < spill->runs; i++) {
+        if (runs[i].fh)
+            fclose(runs[i].fh);
+        free(runs[i].buffer);
+    }
+
+    if (!runs || !heap)
+        strcpy(message, "Out of memory");
+
+    free(runs);
+    free(heap);
+    spill_free(spill);
+
+    return ok;
+}
+
+void spill_free(spill_t *spill)
+{
+    char path[260 + 16];
+
+    for (int i = 0; i < spill->runs; i++) {
+        spill_path(spill, i, path, sizeof path);
+        remove(path);
+    }
+
+    spill->runs = 0;
+    names_free(&spill->names);
+}
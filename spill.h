@@ -0,0 +1,21 @@
+#include <stdbool.h>
+#include <stddef.h>
+
+#define SPILL_MAXRUNS       256     // Most runs merged in one pass
+
+typedef void (*spill_row_t)(void *data, unsigned int address, int type, const char *name);
+
+// Names sorted in a fixed amount of memory. Once the names held reach half
+// the budget they are sorted and written to a run file next to base, and
+// the runs are merged when the names are read back.
+typedef struct spill_t {
+    names_t names;
+    size_t budget;              // Bytes
+    char base[260];
+    int runs;
+} spill_t;
+
+void spill_init(spill_t *spill, const char *base, size_t budget);
+bool spill_add(spill_t *spill, unsigned int address, int type, const char *name, char *message);
+bool spill_finish(spill_t *spill, spill_row_t row, void *data, char *message);
+void spill_free(spill_t *spill);
@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2013 Toni Spets <toni.spets@iki.fi>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * One set of counters for the operation in progress. Saves and loads run
+ * on the OllyDbg main thread, which owns the counters from stats_begin on.
+ * Other threads, like the index worker loading a snapshot, run the same
+ * code but are not counted, so there is no locking.
+ */
+
+#ifdef BACKUP_STATS
+
+#include <windows.h>
+#include <stdio.h>
+#include <string.h>
+#include "stats.h"
+
+stats_t stats_current;
+
+static const char *phase_names[STATS_PHASES] = { "enumerate", "demangle", "utf", "csv", "io", "apply" };
+static const char *counter_names[STATS_COUNTERS] = { "calls", "bytes", "records", "allocs" };
+
+long long stats_now(void)
+{
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    return now.QuadPart;
+}
+
+int stats_owned(void)
+{
+    return GetCurrentThreadId() == stats_current.thread;
+}
+
+void stats_begin(const char *operation)
+{
+    memset(&stats_current, 0, sizeof stats_current);
+    stats_current.operation = operation;
+    stats_current.thread = GetCurrentThreadId();
+    stats_current.start = stats_now();
+}
+
+static double ms(long long ticks)
+{
+    static LARGE_INTEGER frequency;
+
+    if (!frequency.QuadPart)
+        QueryPerformanceFrequency(&frequency);
+
+    return ticks * 1000.0 / frequency.QuadPart;
+}
+
+// Hands a one line summary to line and writes the details to json if given
+void stats_report(stats_line_t line, void *data, const char *json)
+{
+    char text[512];
+    double total = ms(stats_now() - stats_current.start);
+    int len = snprintf(text, sizeof text, "%s: %.1f ms", stats_current.operation, total);
+
+    for (int i = 0; i < STATS_PHASES && len < (int)sizeof text; i++) {
+        if (stats_current.ticks[i])
+            len += snprintf(text + len, sizeof text - len, ", %s %.1f", phase_names[i], ms(stats_current.ticks[i]));
+    }
+
+    for (int i = 0; i < STATS_COUNTERS && len < (int)sizeof text; i++)
+        len += snprintf(text + len, sizeof text - len, ", %llu %s", stats_current.count[i], counter_names[i]);
+
+    line(data, text);
+
+    if (!json)
+        return;
+
+    FILE *fh = fopen(json, "wb");
+    if (!fh)
+        return;
+
+    fprintf(fh, "{\n  \"operation\": \"%s\",\n  \"total_ms\": %.3f,\n  \"phases_ms\": {", stats_current.operation, total);
+
+    for (int i = 0; i < STATS_PHASES; i++)
+        fprintf(fh, "%s\n    \"%s\": %.3f", i ? "," : "", phase_names[i], ms(stats_current.ticks[i]));
+
+    fprintf(fh, "\n  },\n  \"counters\": {");
+
+    for (int i = 0; i < STATS_COUNTERS; i++)
+        fprintf(fh, "%s\n    \"%s\": %llu", i ? "," : "", counter_names[i], stats_current.count[i]);
+
+    fprintf(fh, "\n  }\n}\n");
+    fclose(fh);
+}
+
+#endif
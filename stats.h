@@ -0,0 +1,55 @@
+// Timers and counters for the save and load paths. Build with
+// -DBACKUP_STATS (make STATS=1) to enable, otherwise every macro is empty.
+// Phases may nest, enumerate includes the demangling and conversion done
+// while walking the module. Only the thread that began the operation is
+// counted, code shared with a background worker leaves it alone.
+
+#define STATS_ENUMERATE     0       // Asking OllyDbg for names
+#define STATS_DEMANGLE      1
+#define STATS_UTF           2       // UTF-8 and UTF-16 conversion
+#define STATS_CSV           3       // Formatting or parsing rows
+#define STATS_IO            4       // Reading, flushing and closing files
+#define STATS_APPLY         5       // Handing names to OllyDbg
+#define STATS_PHASES        6
+
+#define STATS_CALLS         0       // Plugin API calls
+#define STATS_BYTES         1       // Bytes read or written
+#define STATS_RECORDS       2       // Rows read or written
+#define STATS_ALLOCS        3
+#define STATS_COUNTERS      4
+
+#ifdef BACKUP_STATS
+
+typedef struct stats_t {
+    const char *operation;
+    unsigned long thread;
+    long long start;
+    long long ticks[STATS_PHASES];
+    long long entered[STATS_PHASES];
+    unsigned long long count[STATS_COUNTERS];
+} stats_t;
+
+typedef void (*stats_line_t)(void *data, const char *text);
+
+extern stats_t stats_current;
+
+long long stats_now(void);
+int stats_owned(void);
+void stats_begin(const char *operation);
+void stats_report(stats_line_t line, void *data, const char *json);
+
+#define STATS_BEGIN(operation)      stats_begin(operation)
+#define STATS_ENTER(phase)          (stats_owned() ? (void)(stats_current.entered[phase] = stats_now()) : (void)0)
+#define STATS_LEAVE(phase)          (stats_owned() ? (void)(stats_current.ticks[phase] += stats_now() - stats_current.entered[phase]) : (void)0)
+#define STATS_ADD(counter, n)       (stats_owned() ? (void)(stats_current.count[counter] += (n)) : (void)0)
+#define STATS_REPORT(line, data, json) stats_report(line, data, json)
+
+#else
+
+#define STATS_BEGIN(operation)      ((void)0)
+#define STATS_ENTER(phase)          ((void)0)
+#define STATS_LEAVE(phase)          ((void)0)
+#define STATS_ADD(counter, n)       ((void)0)
+#define STATS_REPORT(line, data, json) ((void)0)
+
+#endif
@@ -0,0 +1,176 @@
+/*
+ * Copyright (c) 2013 Toni Spets <toni.spets@iki.fi>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Reader for the tagged files OllyDbg 2.01 keeps its .udd data in. Only
+ * depends on the C library so it can be built for other platforms.
+ *
+ * A tagged file is a sequence of records, each a little-endian ulong tag,
+ * a ulong size and size bytes of data. The first record is MI_SIGNATURE and
+ * the last MI_END. Names are MI_DATA records holding a packed t_nameinfo
+ * (ulong offset in module, uchar type) followed by the UTF-16 name. Records
+ * written through Savepackedrecord are compressed with OllyDbg's own
+ * Compress and can't be read here.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "udd.h"
+
+#define NAMEINFO_SIZE   5
+#define MAX_NAME        1024        // UTF-16 characters, longer names are cut
+
+static unsigned int get_ulong(const unsigned char *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (unsigned int)p[3] << 24;
+}
+
+// Converts UTF-16LE to UTF-8, unpaired surrogates become U+FFFD
+static size_t utf16_to_utf8(const unsigned char *src, size_t chars, char *dst)
+{
+    char *out = dst;
+
+    for (size_t i = 0; i < chars; i++) {
+        unsigned int c = src[i * 2] | src[i * 2 + 1] << 8;
+
+        if (c >= 0xD800 && c < 0xDC00 && i + 1 < chars) {
+            unsigned int low = src[i * 2 + 2] | src[i * 2 + 3] << 8;
+            if (low >= 0xDC00 && low < 0xE000) {
+                c = 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+                i++;
+            }
+        }
+
+        if (c >= 0xD800 && c < 0xE000)
+            c = 0xFFFD;
+
+        if (c < 0x80) {
+            *out++ = c;
+        } else if (c < 0x800) {
+            *out++ = 0xC0 | c >> 6;
+            *out++ = 0x80 | (c & 0x3F);
+        } else if (c < 0x10000) {
+            *out++ = 0xE0 | c >> 12;
+            *out++ = 0x80 | (c >> 6 & 0x3F);
+            *out++ = 0x80 | (c & 0x3F);
+        } else {
+            *out++ = 0xF0 | c >> 18;
+            *out++ = 0x80 | (c >> 12 & 0x3F);
+            *out++ = 0x80 | (c >> 6 & 0x3F);
+            *out++ = 0x80 | (c & 0x3F);
+        }
+    }
+
+    *out = '\0';
+    return out - dst;
+}
+
+// Number of UTF-16 characters before the terminator, if there is one
+static size_t utf16_len(const unsigned char *src, size_t size)
+{
+    size_t chars = size / 2;
+
+    while (chars && src[chars * 2 - 2] == 0 && src[chars * 2 - 1] == 0)
+        chars--;
+
+    return chars;
+}
+
+const char *udd_type_string(int type)
+{
+    // same strings the 2.01 plugin writes
+    switch (type) {
+        case UDD_NM_LABEL:      return "LABEL";
+        case UDD_NM_COMMENT:    return "COMMENT";
+        case UDD_NM_EXPORT:     return "EXPORT";
+        case UDD_NM_DEEXP:      return "DEMANGLED_EXPORT";
+        case UDD_NM_IMPORT:     return "IMPORT";
+        case UDD_NM_DEIMP:      return "DEMANGLED_IMPORT";
+        case UDD_NM_DEBUG:      return "DEBUG";
+        case UDD_NM_DEDEBUG:    return "DEMANGLED_DEBUG";
+        case UDD_NM_ANLABEL:    return "ANALYSIS_LABEL";
+        case UDD_NM_ANALYSE:    return "ANALYSIS_COMMENT";
+        case UDD_NM_MARK:       return "PARAMETER";
+        case UDD_NM_CALLED:     return "FUNC_CALL";
+        case UDD_NM_RETTYPE:    return "RETURN_TYPE";
+        case UDD_NM_MODCOMM:    return "MODULE";
+        case UDD_NM_TRICK:      return "TRICKY";
+        default:                return NULL;
+    }
+}
+
+bool udd_read(const unsigned char *buf, size_t size, udd_name_t callback, void *data, udd_info_t *info, char *message)
+{
+    char name[MAX_NAME * 3 + 1];
+    size_t pos = 0;
+
+    memset(info, 0, sizeof *info);
+
+    if (size < 8 || get_ulong(buf) != UDD_MI_SIGNATURE) {
+        strcpy(message, "not an OllyDbg tagged file");
+        return false;
+    }
+
+    while (size - pos >= 8) {
+        unsigned int tag = get_ulong(buf + pos);
+        unsigned int len = get_ulong(buf + pos + 4);
+        const unsigned char *rec = buf + pos + 8;
+
+        pos += 8;
+
+        if (len > size - pos) {
+            sprintf(message, "record %08X at %u runs past the end of the file", tag, (unsigned int)pos - 8);
+            return false;
+        }
+
+        pos += len;
+        info->records++;
+
+        if (tag == UDD_MI_END)
+            break;
+
+        if (tag == UDD_MI_FILENAME) {
+            size_t chars = utf16_len(rec, len);
+            if (chars * 3 < sizeof info->path)
+                utf16_to_utf8(rec, chars, info->path);
+            continue;
+        }
+
+        if (tag != UDD_MI_DATA)
+            continue;
+
+        if (len < NAMEINFO_SIZE || (len - NAMEINFO_SIZE) % 2 || !udd_type_string(rec[4])) {
+            info->skipped++;
+            continue;
+        }
+
+        size_t chars = utf16_len(rec + NAMEINFO_SIZE, len - NAMEINFO_SIZE);
+        if (chars == 0)
+            continue;
+        if (chars > MAX_NAME)
+            chars = MAX_NAME;
+
+        size_t n = utf16_to_utf8(rec + NAMEINFO_SIZE, chars, name);
+
+        info->names++;
+
+        if (callback(data, get_ulong(rec), rec[4], name, n))
+            break;
+    }
+
+    sprintf(message, "%d names in %d records", info->names, info->records);
+    return true;
+}
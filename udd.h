@@ -0,0 +1,38 @@
+#include <stdbool.h>
+#include <stddef.h>
+
+// Tags and name types of OllyDbg 2.01 tagged files, see v201.h
+#define UDD_MI_SIGNATURE    0x00646F4Du
+#define UDD_MI_FILENAME     0x6C69460Au
+#define UDD_MI_DATA         0x7461440Au
+#define UDD_MI_END          0x646E450Au
+
+#define UDD_NM_LABEL        0x21
+#define UDD_NM_EXPORT       0x22
+#define UDD_NM_DEEXP        0x23
+#define UDD_NM_IMPORT       0x26
+#define UDD_NM_DEIMP        0x27
+#define UDD_NM_DEBUG        0x29
+#define UDD_NM_DEDEBUG      0x2A
+#define UDD_NM_ANLABEL      0x2B
+#define UDD_NM_COMMENT      0x30
+#define UDD_NM_ANALYSE      0x31
+#define UDD_NM_MARK         0x32
+#define UDD_NM_CALLED       0x33
+#define UDD_NM_RETTYPE      0x36
+#define UDD_NM_MODCOMM      0x37
+#define UDD_NM_TRICK        0x38
+
+typedef struct udd_info_t {
+    char path[1024];            // UTF-8 path of the executable, empty if absent
+    int records;
+    int names;
+    int skipped;                // MI_DATA records that are not names or don't decode
+} udd_info_t;
+
+// Called for each name in file order, name is UTF-8 and null-terminated.
+// A nonzero return stops the walk.
+typedef int (*udd_name_t)(void *data, unsigned int offset, int type, const char *name, size_t len);
+
+bool udd_read(const unsigned char *buf, size_t size, udd_name_t callback, void *data, udd_info_t *info, char *message);
+const char *udd_type_string(int type);
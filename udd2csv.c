@@ -0,0 +1,394 @@
+/*
+ * Copyright (c) 2013 Toni Spets <toni.spets@iki.fi>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Converts OllyDbg 2.01 .udd files to the CSV snapshots the plugin reads,
+ * without the debugger. Directories are searched for .udd files and the
+ * files are converted in parallel, each next to its .udd or in -o DIR,
+ * where the directories below the searched one are created again. With -i
+ * the search index of each snapshot is written next to it.
+ */
+
+#define _XOPEN_SOURCE 500
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <ftw.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "udd.h"
+#include "backup.h"
+#include "search.h"
+
+#define OUT_BUFFER  (1024 * 1024)
+
+typedef struct profile_t {
+    const char *name;
+    int types[16];
+} profile_t;
+
+// the same profiles as the plugin menu
+static const profile_t profiles[] = {
+    { "user", { UDD_NM_LABEL, UDD_NM_COMMENT } },
+    { "system", { UDD_NM_EXPORT, UDD_NM_DEEXP, UDD_NM_IMPORT, UDD_NM_DEIMP, UDD_NM_ANLABEL } },
+    { "func-calls", { UDD_NM_RETTYPE, UDD_NM_CALLED, UDD_NM_MARK } },
+    { "all", { UDD_NM_LABEL, UDD_NM_COMMENT, UDD_NM_EXPORT, UDD_NM_DEEXP, UDD_NM_IMPORT, UDD_NM_DEIMP,
+               UDD_NM_DEBUG, UDD_NM_DEDEBUG, UDD_NM_ANLABEL, UDD_NM_ANALYSE, UDD_NM_MARK,
+               UDD_NM_CALLED, UDD_NM_RETTYPE, UDD_NM_MODCOMM, UDD_NM_TRICK } },
+};
+
+static const profile_t *profile = &profiles[0];
+static bool wanted[256];
+static const char *outdir = NULL;
+static bool index_names = false;
+
+typedef struct input_t {
+    char *path;
+    int rel;                    // offset of the part mirrored under -o
+} input_t;
+
+static input_t *files = NULL;
+static int nfiles = 0;
+static int capacity = 0;
+static int walk_root = 0;
+
+static int next_file = 0;
+static int failed = 0;
+static int converted = 0;
+static long total_names = 0;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void add_file(const char *path, int rel)
+{
+    if (nfiles == capacity) {
+        capacity = capacity ? capacity * 2 : 256;
+        files = realloc(files, capacity * sizeof(input_t));
+        if (!files) {
+            perror("udd2csv");
+            exit(1);
+        }
+    }
+
+    while (path[rel] == '/')
+        rel++;
+
+    files[nfiles].path = strdup(path);
+    files[nfiles].rel = rel;
+    nfiles++;
+}
+
+static bool is_udd(const char *path)
+{
+    size_t len = strlen(path);
+    return len > 4 && strcasecmp(path + len - 4, ".udd") == 0;
+}
+
+static int walk(const char *path, const struct stat *st, int flag, struct FTW *ftw)
+{
+    if (flag == FTW_F && is_udd(path))
+        add_file(path, walk_root);
+
+    return 0;
+}
+
+typedef struct output_t {
+    FILE *fh;
+    int names;
+    names_t index;              // kept only with -i
+} output_t;
+
+static int write_name(void *data, unsigned int offset, int type, const char *name, size_t len)
+{
+    output_t *out = data;
+
+    if (!wanted[type])
+        return 0;
+
+    out->names++;
+
+    if (index_names && !names_add_n(&out->index, offset, type, name, len))
+        return 1;
+
+    backup_write_row(out->fh, offset, udd_type_string(type), name);
+    return 0;
+}
+
+// Next to the input, or under -o with the directories of the input below
+// the one that was searched
+static void output_path(const input_t *input, char *buf, size_t size)
+{
+    const char *path = input->path;
+    const char *base = strrchr(path, '/');
+    base = base ? base + 1 : path;
+
+    const char *dir = outdir ? path + input->rel : path;
+    int dir_len = (int)(base - dir);
+    int stem_len = (int)strlen(base) - (is_udd(base) ? 4 : 0);
+
+    snprintf(buf, size, "%s%s%.*s%.*s-%s.csv", outdir ? outdir : "", outdir ? "/" : "",
+             dir_len, dir, stem_len, base, profile->name);
+}
+
+// Creates -o and the directories of path below it
+static bool make_dirs(const char *path)
+{
+    char dir[4096];
+
+    snprintf(dir, sizeof dir, "%s", path);
+
+    for (char *slash = dir + 1; (slash = strchr(slash, '/')); slash++) {
+        *slash = '\0';
+        if (mkdir(dir, 0777) != 0 && errno != EEXIST)
+            return false;
+        *slash = '/';
+    }
+
+    return true;
+}
+
+static int compare_outputs(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Two inputs written to one snapshot would overwrite each other, possibly
+// at the same time
+static bool unique_outputs(void)
+{
+    char **outputs = malloc(nfiles * sizeof(char *));
+    char path[4096];
+    bool unique = true;
+
+    if (!outputs) {
+        perror("udd2csv");
+        exit(1);
+    }
+
+    for (int i = 0; i < nfiles; i++) {
+        output_path(&files[i], path, sizeof path);
+        outputs[i] = strdup(path);
+    }
+
+    qsort(outputs, nfiles, sizeof(char *), compare_outputs);
+
+    for (int i = 1; i < nfiles; i++) {
+        if (strcmp(outputs[i - 1], outputs[i]) == 0 && (i < 2 || strcmp(outputs[i - 2], outputs[i]) != 0)) {
+            fprintf(stderr, "%s: written by more than one input\n", outputs[i]);
+            unique = false;
+        }
+    }
+
+    for (int i = 0; i < nfiles; i++)
+        free(outputs[i]);
+    free(outputs);
+
+    return unique;
+}
+
+static bool convert(const input_t *file, char *message, int *names)
+{
+    const char *input = file->path;
+    char path[4096];
+    char status[256];
+    udd_info_t info;
+    struct stat st;
+
+    FILE *in = fopen(input, "rb");
+    if (!in) {
+        strcpy(message, "failed to open for reading");
+        return false;
+    }
+
+    if (fstat(fileno(in), &st) != 0 || st.st_size == 0) {
+        fclose(in);
+        strcpy(message, "empty file");
+        return false;
+    }
+
+    unsigned char *buf = malloc(st.st_size);
+    if (!buf || fread(buf, 1, st.st_size, in) != (size_t)st.st_size) {
+        free(buf);
+        fclose(in);
+        strcpy(message, "failed to read");
+        return false;
+    }
+
+    fclose(in);
+
+    output_path(file, path, sizeof path);
+
+    if (outdir && !make_dirs(path)) {
+        free(buf);
+        sprintf(message, "the directory of %.200s could not be created", path);
+        return false;
+    }
+
+    output_t out = { fopen(path, "wb"), 0, { 0 } };
+    if (!out.fh) {
+        free(buf);
+        sprintf(message, "%.200s could not be opened for writing", path);
+        return false;
+    }
+
+    setvbuf(out.fh, NULL, _IOFBF, OUT_BUFFER);
+    fprintf(out.fh, "RVA,label_type,label\r\n");
+
+    bool ret = udd_read(buf, st.st_size, write_name, &out, &info, status);
+
+    free(buf);
+
+    if (fclose(out.fh) != 0 && ret) {
+        strcpy(status, "write failed");
+        ret = false;
+    }
+
+    if (ret && index_names) {
+        char idx[4096];
+
+        if (out.index.count != out.names) {
+            strcpy(status, "out of memory");
+            ret = false;
+        } else {
+            names_sort(&out.index);
+            search_index_path(idx, sizeof idx, path);
+            ret = search_write(idx, &out.index, status);
+        }
+    }
+
+    names_free(&out.index);
+
+    if (!ret) {
+        remove(path);
+        strcpy(message, status);
+        return false;
+    }
+
+    *names = out.names;
+    return true;
+}
+
+static void *worker(void *param)
+{
+    char message[512];
+
+    for (;;) {
+        int names = 0;
+        int i = __sync_fetch_and_add(&next_file, 1);
+
+        if (i >= nfiles)
+            break;
+
+        if (convert(&files[i], message, &names)) {
+            __sync_fetch_and_add(&total_names, names);
+            __sync_fetch_and_add(&converted, 1);
+        } else {
+            pthread_mutex_lock(&lock);
+            fprintf(stderr, "%s: %s\n", files[i].path, message);
+            failed++;
+            pthread_mutex_unlock(&lock);
+        }
+    }
+
+    return NULL;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: udd2csv [-j jobs] [-p user|system|func-calls|all] [-o dir] [-i] file.udd|dir...\n");
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    int c;
+
+    while ((c = getopt(argc, argv, "j:p:o:i")) != -1) {
+        switch (c) {
+            case 'j':
+                jobs = atol(optarg);
+                break;
+            case 'p':
+                profile = NULL;
+                for (size_t i = 0; i < sizeof profiles / sizeof profiles[0]; i++) {
+                    if (strcmp(optarg, profiles[i].name) == 0)
+                        profile = &profiles[i];
+                }
+                if (!profile)
+                    usage();
+                break;
+            case 'o':
+                outdir = optarg;
+                break;
+            case 'i':
+                index_names = true;
+                break;
+            default:
+                usage();
+        }
+    }
+
+    if (optind == argc)
+        usage();
+
+    for (int i = 0; i < 16 && profile->types[i]; i++)
+        wanted[profile->types[i]] = true;
+
+    for (int i = optind; i < argc; i++) {
+        struct stat st;
+
+        if (stat(argv[i], &st) != 0) {
+            perror(argv[i]);
+            failed++;
+        } else if (S_ISDIR(st.st_mode)) {
+            walk_root = strlen(argv[i]);
+            nftw(argv[i], walk, 64, FTW_PHYS);
+        } else {
+            const char *base = strrchr(argv[i], '/');
+            add_file(argv[i], base ? (int)(base - argv[i]) + 1 : 0);
+        }
+    }
+
+    if (!unique_outputs())
+        return 1;
+
+    if (jobs < 1)
+        jobs = 1;
+    if (jobs > nfiles)
+        jobs = nfiles;
+
+    pthread_t *threads = calloc(jobs ? jobs : 1, sizeof(pthread_t));
+
+    for (long i = 0; i < jobs; i++)
+        pthread_create(&threads[i], NULL, worker, NULL);
+
+    for (long i = 0; i < jobs; i++)
+        pthread_join(threads[i], NULL);
+
+    fprintf(stderr, "Converted %d of %d files, %ld names\n", converted, nfiles, total_names);
+
+    free(threads);
+    for (int i = 0; i < nfiles; i++)
+        free(files[i].path);
+    free(files);
+
+    return failed ? 1 : 0;
+}
@@ -18,6 +18,7 @@
 #include <windows.h>
 #include "backup.h"
 #include "list.h"
+#include "stats.h"
 
 #define _MSC_VER
 #ifdef __CHAR_UNSIGNED__
@@ -48,8 +49,15 @@
 #undef Findname
 #undef Findmodule
 
+#define ENGINE_CHAR                             char
+#define ENGINE_FIND(address, type, buf, len)    Findname(address, type, buf)
+#define ENGINE_INSERT(address, type, name)      Quickinsertname(address, type, name)
+#define ENGINE_MERGE()                          Mergequicknames()
+#include "engine.h"
+
 static void LoadFromFile(t_module *module, const char *filename);
 static void SaveToFile(t_module *module, const char *filename);
+static void ReportStats(void);
 
 static bool initialized = false;
 
@@ -88,7 +96,9 @@ int _export cdecl ODBG_Plugindata(char *shortname)
 
 bool backup_save(const char *filename, rva_t *rvas, char *message)
 {
+    STATS_ENTER(STATS_IO);
     FILE *fh = fopen(filename, "wb");
+    STATS_LEAVE(STATS_IO);
 
     if (!fh) {
         sprintf(message, "File %s could not be opened for writing", filename);
@@ -100,38 +110,54 @@ bool backup_save(const char *filename, rva_t *rvas, char *message)
         return false;
     }
 
+    STATS_ENTER(STATS_CSV);
+
     fprintf(fh, "RVA,label,comment\r\n");
 
     int labels = 0;
     int comments = 0;
 
-    LIST_FOREACH (rvas, rva_t, rva) {
-        if (rva->label[0]) {
-            labels++;
-        }
-
-        if (rva->comment[0]) {
-            comments++;
+    // rows come one per name in address order, the label and the comment of
+    // an address share a line
+    for (rva_t *rva = rvas; rva; ) {
+        const char *label = "";
+        const char *comment = "";
+        unsigned int address = rva->address;
+
+        for (; rva && rva->address == address; rva = rva->next) {
+            if (rva->raw_type == NM_LABEL) {
+                label = rva->name;
+                labels++;
+            } else {
+                comment = rva->name;
+                comments++;
+            }
         }
 
-        fprintf(fh, "%08X,", rva->address);
+        fprintf(fh, "%08X,", address);
 
-        if (strchr(rva->label, ',') || strchr(rva->label, '"'))
-            csv_fwrite(fh, rva->label, strlen(rva->label));
+        if (strchr(label, ',') || strchr(label, '"'))
+            csv_fwrite(fh, label, strlen(label));
         else
-            fwrite(rva->label, strlen(rva->label), 1, fh);
+            fwrite(label, strlen(label), 1, fh);
 
         fwrite(",", 1, 1, fh);
 
-        if (strchr(rva->comment, ',') || strchr(rva->comment, '"'))
-            csv_fwrite(fh, rva->comment, strlen(rva->comment));
+        if (strchr(comment, ',') || strchr(comment, '"'))
+            csv_fwrite(fh, comment, strlen(comment));
         else
-            fwrite(rva->comment, strlen(rva->comment), 1, fh);
+            fwrite(comment, strlen(comment), 1, fh);
 
         fwrite("\r\n", 2, 1, fh);
+        STATS_ADD(STATS_RECORDS, 1);
     }
 
+    STATS_LEAVE(STATS_CSV);
+    STATS_ADD(STATS_BYTES, ftell(fh));
+
+    STATS_ENTER(STATS_IO);
     fclose(fh);
+    STATS_LEAVE(STATS_IO);
 
     sprintf(message, "Saved %d labels and %d comments to %s", labels, comments, filename);
     return true;
@@ -223,7 +249,10 @@ void _export cdecl ODBG_Pluginaction(int origin, int action, void *item)
 static void LoadFromFile(t_module *module, const char *filename)
 {
     char message[1024];
-    rva_t *rvas = backup_load(filename, message);
+
+    STATS_BEGIN("load");
+
+    rva_t *rvas = backup_load(filename, NULL, message);
 
     if (rvas == NULL) {
         Flash(message);
@@ -231,51 +260,49 @@ static void LoadFromFile(t_module *module, const char *filename)
     }
 
     LIST_FOREACH (rvas, rva_t, rva) {
-        if (rva->label[0]) {
-            Quickinsertname(module->base + rva->address, NM_LABEL, rva->label);
-        }
-        if (rva->comment[0]) {
-            Quickinsertname(module->base + rva->address, NM_COMMENT, rva->comment);
-        }
+        if (rva->label[0])
+            engine_insert(module->base + rva->address, NM_LABEL, rva->label);
+        if (rva->comment[0])
+            engine_insert(module->base + rva->address, NM_COMMENT, rva->comment);
     }
 
     LIST_FREE(rvas);
 
-    Mergequicknames();
+    engine_merge();
 
     Infoline(message);
+    ReportStats();
 }
 
 static void SaveToFile(t_module *module, const char *filename)
 {
-    unsigned int end = module->base + module->size;
-
-    char label[TEXTLEN];
-    char comment[TEXTLEN];
-
-    rva_t *rvas = NULL;
+    static const int types[] = { NM_LABEL, NM_COMMENT };
 
-    for (unsigned int address = end; address > module->base; address--) {
+    STATS_BEGIN("save");
 
-        label[0] = '\0';
-        comment[0] = '\0';
-
-        Findname(address, NM_LABEL, label);
-        Findname(address, NM_COMMENT, comment);
-
-        if (label[0] || comment[0]) {
-            rva_t *rva = malloc(sizeof(rva_t));
-            rva->address = address - module->base;
-            strcpy_s(rva->label, sizeof(rva->label), label);
-            strcpy_s(rva->comment, sizeof(rva->label), comment);
-            LIST_INSERT(rvas, rva);
-        }
-    }
+    rva_t *rvas = engine_collect(module->base, module->size, types, 2);
 
     char message[1024];
     if (backup_save(filename, rvas, message)) {
         Infoline(message);
+        ReportStats();
     } else {
         Flash(message);
     }
+
+    LIST_FREE(rvas);
+}
+
+#ifdef BACKUP_STATS
+static void StatsLine(void *data, const char *text)
+{
+    Addtolist(0, 0, "%s", text);
+}
+#endif
+
+// Logs where the time of the last save or load went, only when built with
+// BACKUP_STATS
+static void ReportStats(void)
+{
+    STATS_REPORT(StatsLine, NULL, NULL);
 }
@@ -17,15 +17,67 @@
 #define UNICODE
 #define _UNICODE
 
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
 #include <windows.h>
 #include "backup.h"
 #include "list.h"
+#include "journal.h"
+#include "search.h"
+#include "catalog.h"
+#include "retention.h"
+#include "stats.h"
+#include "analysis.h"
+#include "records.h"
+#include "port.h"
+#include "corpus.h"
+#include "spill.h"
 
 #include "v201.h"
 //
 
+static ulong anlabeladdress;
+
+// NM_ANLABEL and its mangled pseudo type share one lookup and demangle, the
+// scan asks for both at an address one after the other
+static int FindCollectName(ulong address, int type, wchar_t *buf, int len)
+{
+    static wchar_t anlabel[TEXTLEN];
+    static wchar_t demangled[TEXTLEN];
+    static bool anlabel_demangled;
+
+    if (type != NM_ANLABEL && type != NM_ANLABEL + 1)
+        return FindnameW(address, type, buf, len);
+
+    if (address != anlabeladdress) {
+        anlabeladdress = address;
+        anlabel[0] = L'\0';
+        anlabel_demangled = false;
+        FindnameW(address, NM_ANLABEL, anlabel, _countof(anlabel));
+        if (anlabel[0]) {
+            STATS_ENTER(STATS_DEMANGLE);
+            anlabel_demangled = DemanglenameW(anlabel, demangled, 0);
+            STATS_LEAVE(STATS_DEMANGLE);
+            STATS_ADD(STATS_CALLS, 1);
+        }
+    }
+
+    if (!anlabel[0] || (type == NM_ANLABEL + 1 && !anlabel_demangled))
+        return 0;
+
+    wcscpy_s(buf, len, type == NM_ANLABEL && anlabel_demangled ? demangled : anlabel);
+    return wcslen(buf);
+}
+
+#define ENGINE_CHAR                             wchar_t
+#define ENGINE_FIND(address, type, buf, len)    FindCollectName(address, type, buf, len)
+#define ENGINE_INSERT(address, type, name)      QuickinsertnameW(address, type, name)
+#define ENGINE_MERGE()                          Mergequickdata()
+#define ENGINE_TO_UTF(src, len, dst, size)      Unicodetoutf(src, len, dst, size)
+#define ENGINE_FROM_UTF(src, len, dst, size)    Utftounicode(src, len, dst, size)
+#include "engine.h"
+
 #define PLUGINNAME      L"Ultra Backup"
 #define PLUGINDESC      L"Backup and restore current labels and comments."
 
@@ -93,29 +145,116 @@ static const NAME_TYPE * AllNameTypes[] = {
     NULL
 };
 
+// One more than the index in AllNameTypes, the gaps stay 0 for raw types
+// that are not name types
 static const int RawTypeLookup[] = {
-    [NM_LABEL] = 0,
-    [NM_COMMENT] = 1,
-    [NM_EXPORT] = 2,
-    [NM_DEEXP] = 3,
-    [NM_IMPORT] = 4,
-    [NM_DEIMP] = 5,
-    [NM_DEBUG] = 6,
-    [NM_DEDEBUG] = 7,
-    [NM_ANLABEL] = 8,
-    [NM_ANLABEL+1] = 9,
-    [NM_ANALYSE] = 10,
-    [NM_MARK] = 11,
-    [NM_CALLED] = 12,
-    [NM_RETTYPE] = 13,
-    [NM_MODCOMM] = 14,
-    [NM_TRICK] = 15
+    [NM_LABEL] = 1,
+    [NM_COMMENT] = 2,
+    [NM_EXPORT] = 3,
+    [NM_DEEXP] = 4,
+    [NM_IMPORT] = 5,
+    [NM_DEIMP] = 6,
+    [NM_DEBUG] = 7,
+    [NM_DEDEBUG] = 8,
+    [NM_ANLABEL] = 9,
+    [NM_ANLABEL+1] = 10,
+    [NM_ANALYSE] = 11,
+    [NM_MARK] = 12,
+    [NM_CALLED] = 13,
+    [NM_RETTYPE] = 14,
+    [NM_MODCOMM] = 15,
+    [NM_TRICK] = 16
 };
 
-static void LoadFromFile(t_module *module, const wchar_t *filename);
+typedef struct PROFILE {
+    const wchar_t *suffix;
+    const NAME_TYPE **types;
+} PROFILE;
+
+static const PROFILE Profiles[] = {
+    { L"-user", UserNameTypes },
+    { L"-system", SystemNameTypes },
+    { L"-func-calls", FuncCallsNameTypes },
+    { L"-all", AllNameTypes },
+    { NULL, NULL }
+};
+
+static void LoadFromFile(t_module *module, const wchar_t *filename, const NAME_TYPE **Names, bool exact);
+static void LoadRangeFromFile(t_module *module, ulong addr0, ulong addr1, const wchar_t *filename, const NAME_TYPE **Names, bool exact);
+static void ExportRangeToFile(t_module *module, ulong addr0, ulong addr1, const wchar_t *filename);
 static void SaveToFile(t_module *module, const wchar_t *filename, const NAME_TYPE** Names);
+static void SaveProfilesToFiles(t_module *module, const wchar_t *basename, const wchar_t *stamp);
+static void SaveAllModules(const wchar_t *filename);
+static void LoadAllModules(const wchar_t *filename);
+static void AutoSnapshot(t_module *module, bool force);
+static void ForgetSnapshot(t_module *module);
+static void IndexNames(const char *filename, const names_t *names);
+static void ReportStats(const char *filename);
+static void CatalogCount(catalog_t *entry, int *counts, unsigned int address, int raw_type, const char *name);
+static void CatalogWrite(t_module *module, const char *filename, catalog_t *entry, const int *counts, const NAME_TYPE **Names, const identity_t *identity);
+static void ShowHistory(t_module *module);
+static void ApplyRetention(t_module *module, bool verbose);
+static void ReapRetention(DWORD timeout);
+static void ReapIndex(DWORD timeout, bool browse);
+static void SearchSnapshots(t_module *module, const wchar_t *basename);
+static bool IndexIsCurrent(const wchar_t *filename, const wchar_t *path);
+static void BrowseSnapshot(const wchar_t *filename);
+static void CloseSnapshotBrowser(void);
+static bool SaveAnalysis(t_module *pmod, bool verbose);
+static bool RestoreAnalysis(t_module *pmod, bool verbose);
+static bool SaveDataRecords(t_module *module);
+static bool LoadDataRecords(t_module *module);
+static bool SaveBreakpoints(t_module *module);
+static bool LoadBreakpoints(t_module *module);
+static bool SaveFingerprints(t_module *module);
+static void PortNames(t_module *module, const wchar_t *fingerprints, const wchar_t *snapshot);
+static void AddModuleToCorpus(t_module *module);
+static void AddSnapshotToCorpus(const wchar_t *fingerprints, const wchar_t *snapshot);
+static void LabelFromCorpus(t_module *module);
+
+static void OpenJournal(t_module *module);
+static void UpdateJournal(t_module *module);
+static void CloseJournal(void);
+static int NameTypeList(const NAME_TYPE **Names, int *list);
+static const char *NameTypeString(int type);
+static void EnumerateNameList(t_module *module, const int *list, int n, names_t *names);
+static void EnumerateNameRange(t_module *module, ulong addr0, ulong addr1, const int *list, int n, names_t *names);
+
+#define AUTOSAVE_INTERVAL   60000   // Minimal delay between automatic snapshots of a module, ms
+#define JOURNAL_INTERVAL    2000    // Minimal delay between journal updates, ms
+#define SEARCH_RESULTS      10000   // Most names listed for one search
+#define PORT_MAXPROC        0x10000 // Largest procedure fingerprinted, bytes
 
 static bool initialized = false;
+static bool closing = false;
+static int autosave = 1;
+static int journaling = 1;
+static int embedudd = 0;
+static int exactrestore = 0;
+static int indexsnapshots = 1;
+static int cacheanalysis = 0;
+static int portconfidence = PORT_SHAPE;
+static int exportbudget = 64;
+static t_table searchtable;
+static t_table browsetable;
+static t_table historytable;
+static retention_t retention = { 0 };
+static retention_job_t retentionjob;
+
+// A snapshot index built in the background for the browser
+typedef struct INDEX_JOB {
+    wchar_t snapshot[MAXPATH];  // Browsed once the index is built
+    char csv[MAXPATH];
+    char idx[MAXPATH];
+    char message[1024];
+    bool ok;
+    HANDLE worker;
+} INDEX_JOB;
+
+static INDEX_JOB indexjob;
+#ifdef BACKUP_STATS
+static int statsfiles = 0;
+#endif
 
 extc int _export cdecl ODBG2_Pluginquery(int ollydbgversion, ulong *features, wchar_t pluginname[SHORTNAME], wchar_t pluginversion[SHORTNAME])
 {
@@ -129,11 +268,208 @@ extc int _export cdecl ODBG2_Pluginquery(int ollydbgversion, ulong *features, wc
     return PLUGIN_VERSION;
 }
 
+extc int _export cdecl ODBG2_Plugininit(void)
+{
+    Getfromini(NULL, PLUGINNAME, L"Automatic snapshots", L"%i", &autosave);
+    Getfromini(NULL, PLUGINNAME, L"Journal", L"%i", &journaling);
+    Getfromini(NULL, PLUGINNAME, L"Embed in UDD", L"%i", &embedudd);
+    Getfromini(NULL, PLUGINNAME, L"Restore exactly", L"%i", &exactrestore);
+    Getfromini(NULL, PLUGINNAME, L"Index snapshots", L"%i", &indexsnapshots);
+    Getfromini(NULL, PLUGINNAME, L"Cache analysis", L"%i", &cacheanalysis);
+    Getfromini(NULL, PLUGINNAME, L"Port confidence", L"%i", &portconfidence);
+    Getfromini(NULL, PLUGINNAME, L"Export memory budget", L"%i", &exportbudget);
+
+    // in bytes the budget has to fit a 32-bit size_t
+    if (exportbudget < 1)
+        exportbudget = 1;
+    else if (exportbudget > 2047)
+        exportbudget = 2047;
+
+    Getfromini(NULL, PLUGINNAME, L"Keep latest", L"%i", &retention.latest);
+    Getfromini(NULL, PLUGINNAME, L"Keep hourly", L"%i", &retention.hourly);
+    Getfromini(NULL, PLUGINNAME, L"Keep daily", L"%i", &retention.daily);
+    Getfromini(NULL, PLUGINNAME, L"Keep weekly", L"%i", &retention.weekly);
+    Getfromini(NULL, PLUGINNAME, L"Snapshot size cap", L"%u", &retention.cap);
+#ifdef BACKUP_STATS
+    Getfromini(NULL, PLUGINNAME, L"Statistics files", L"%i", &statsfiles);
+#endif
+    return 0;
+}
+
+// Called when OllyDbg has finished analysing a module. A cache of the same
+// build fills in what this analysis did not find, then the result is cached
+// if it differs from the cache.
+extc void _export cdecl ODBG2_Pluginanalyse(t_module *pmod)
+{
+    if (!initialized || !cacheanalysis || !pmod)
+        return;
+
+    RestoreAnalysis(pmod, false);
+    SaveAnalysis(pmod, false);
+}
+
+extc void _export cdecl ODBG2_Pluginmainloop(DEBUG_EVENT *debugevent)
+{
+    static DWORD last;
+
+    if (retentionjob.worker || retentionjob.expired)
+        ReapRetention(0);
+
+    if (indexjob.worker)
+        ReapIndex(0, true);
+
+    if (!initialized || !journaling)
+        return;
+
+    DWORD now = GetTickCount();
+
+    if (now - last < JOURNAL_INTERVAL)
+        return;
+
+    last = now;
+
+    UpdateJournal(Findmainmodule());
+}
+
+extc void _export cdecl ODBG2_Pluginnotify(int code, void *data, ulong parm1, ulong parm2)
+{
+    if (code == PN_ENDPROC) {
+        if (initialized && journaling)
+            UpdateJournal(Findmainmodule());
+        CloseJournal();
+    }
+
+    if (!initialized || !autosave)
+        return;
+
+    switch (code) {
+        case PN_STATUS:
+            if (run.status == STAT_PAUSED)
+                AutoSnapshot(Findmainmodule(), false);
+            break;
+
+        case PN_ENDMOD:
+            AutoSnapshot((t_module *)data, true);
+            ForgetSnapshot((t_module *)data);
+            break;
+
+        case PN_ENDPROC:
+            AutoSnapshot(Findmainmodule(), true);
+            ForgetSnapshot(NULL);
+            break;
+    }
+}
+
+extc void _export cdecl ODBG2_Plugindestroy(void)
+{
+    // no worker may outlive the DLL
+    ReapRetention(INFINITE);
+    ReapIndex(INFINITE, false);
+
+    if (searchtable.sorted.itemsize)
+        Destroysorteddata(&searchtable.sorted);
+
+    CloseSnapshotBrowser();
+
+    if (browsetable.sorted.itemsize)
+        Destroysorteddata(&browsetable.sorted);
+
+    if (historytable.sorted.itemsize)
+        Destroysorteddata(&historytable.sorted);
+
+    backup_free_identities();
+}
+
+extc int _export cdecl ODBG2_Pluginclose(void)
+{
+    if (initialized && journaling)
+        UpdateJournal(Findmainmodule());
+
+    CloseJournal();
+
+    // the last snapshot does not start retention, the workers are waited
+    // for after it
+    closing = true;
+
+    if (initialized && autosave)
+        AutoSnapshot(Findmainmodule(), true);
+
+    ReapRetention(INFINITE);
+    ReapIndex(INFINITE, false);
+
+    return 0;
+}
+
+static void FormatTimestamp(wchar_t *buf, int len)
+{
+    wchar_t tbuf[16];
+
+    GetDateFormatW(LOCALE_USER_DEFAULT, 0, NULL, L"-yyyy''MM''dd", buf, len);
+    GetTimeFormatW(LOCALE_USER_DEFAULT, TIME_FORCE24HOURFORMAT, NULL, L"_hh''mm''ss", tbuf, _countof(tbuf));
+    wcscat_s(buf, len, tbuf);
+}
+
 static int menucb(t_table *pt, wchar_t *name, ulong index, int mode)
 {
     if (!initialized)
         return MENU_GRAYED;
 
+    if (index == 18) {
+        if (mode == MENU_VERIFY)
+            return autosave ? MENU_CHECKED : MENU_NORMAL;
+
+        autosave = !autosave;
+        Writetoini(NULL, PLUGINNAME, L"Automatic snapshots", L"%i", autosave);
+        return MENU_NOREDRAW;
+    }
+
+    if (index == 19) {
+        if (mode == MENU_VERIFY)
+            return journaling ? MENU_CHECKED : MENU_NORMAL;
+
+        journaling = !journaling;
+        if (!journaling)
+            CloseJournal();
+        Writetoini(NULL, PLUGINNAME, L"Journal", L"%i", journaling);
+        return MENU_NOREDRAW;
+    }
+
+    if (index == 20) {
+        if (mode == MENU_VERIFY)
+            return embedudd ? MENU_CHECKED : MENU_NORMAL;
+
+        embedudd = !embedudd;
+        Writetoini(NULL, PLUGINNAME, L"Embed in UDD", L"%i", embedudd);
+        return MENU_NOREDRAW;
+    }
+
+    if (index == 24) {
+        if (mode == MENU_VERIFY)
+            return exactrestore ? MENU_CHECKED : MENU_NORMAL;
+
+        exactrestore = !exactrestore;
+        Writetoini(NULL, PLUGINNAME, L"Restore exactly", L"%i", exactrestore);
+        return MENU_NOREDRAW;
+    }
+
+    if (index == 25) {
+        if (mode == MENU_VERIFY)
+            return indexsnapshots ? MENU_CHECKED : MENU_NORMAL;
+
+        indexsnapshots = !indexsnapshots;
+        Writetoini(NULL, PLUGINNAME, L"Index snapshots", L"%i", indexsnapshots);
+        return MENU_NOREDRAW;
+    }
+
+    if (index == 30) {
+        if (mode == MENU_VERIFY)
+            return cacheanalysis ? MENU_CHECKED : MENU_NORMAL;
+
+        cacheanalysis = !cacheanalysis;
+        Writetoini(NULL, PLUGINNAME, L"Cache analysis", L"%i", cacheanalysis);
+        return MENU_NOREDRAW;
+    }
+
     t_module *module = Findmainmodule();
 
     if (module == NULL)
@@ -222,49 +558,168 @@ static int menucb(t_table *pt, wchar_t *name, ulong index, int mode)
             {
                 wchar_t tbuf[32];
                 wcscat_s(buf, _countof(buf), temp);
-                GetDateFormatW(LOCALE_USER_DEFAULT, 0, NULL, L"-yyyy''MM''dd", tbuf, _countof(tbuf));
-                wcscat_s(buf, _countof(buf), tbuf);
-                GetTimeFormatW(LOCALE_USER_DEFAULT, TIME_FORCE24HOURFORMAT, NULL, L"_hh''mm''ss", tbuf, sizeof tbuf);
-                GetTimeFormatW(LOCALE_USER_DEFAULT, TIME_FORCE24HOURFORMAT, NULL, L"_hh''mm''ss", tbuf, _countof(tbuf));
+                FormatTimestamp(tbuf, _countof(tbuf));
                 wcscat_s(buf, _countof(buf), tbuf);
                 wcscat_s(buf, _countof(buf), L".csv");
                 SaveToFile(module, buf, name_types);
                 break;
             }
 
+            case 16:
+                SaveProfilesToFiles(module, buf, L"");
+                break;
+
+            case 17:
+            {
+                wchar_t tbuf[32];
+                FormatTimestamp(tbuf, _countof(tbuf));
+                SaveProfilesToFiles(module, buf, tbuf);
+                break;
+            }
+
+            case 21:
+                wcscat_s(buf, _countof(buf), L"-modules.csv");
+                SaveAllModules(buf);
+                break;
+
+            case 22:
+                wcscat_s(buf, _countof(buf), L"-modules.csv");
+                LoadAllModules(buf);
+                break;
+
+            case 23:
+                wcscat_s(buf, _countof(buf), L"-modules.csv");
+                if (Browsefilename(L"Select a Modules CSV file...", buf, NULL, NULL, L".csv", NULL, 0)) {
+                    LoadAllModules(buf);
+                }
+                break;
+
+            case 26:
+                SearchSnapshots(module, buf);
+                break;
+
+            case 28:
+                ShowHistory(module);
+                break;
+
+            case 29:
+                ApplyRetention(module, true);
+                break;
+
+            case 31:
+                if (RestoreAnalysis(module, true))
+                    Redrawcpudisasm();
+                break;
+
+            case 32:
+                SaveAnalysis(module, true);
+                break;
+
+            case 33:
+                SaveDataRecords(module);
+                break;
+
+            case 34:
+                if (LoadDataRecords(module))
+                    Redrawcpudisasm();
+                break;
+
+            case 35:
+                SaveBreakpoints(module);
+                break;
+
+            case 36:
+                if (LoadBreakpoints(module))
+                    Redrawcpudisasm();
+                break;
+
+            case 37:
+                SaveFingerprints(module);
+                break;
+
+            case 38:
+            case 40: {
+                wchar_t snapshot[MAXPATH];
+
+                wcscat_s(buf, _countof(buf), L"-fingerprints.bin");
+                if (!Browsefilename(L"Select fingerprints of the older build...", buf, NULL, NULL, L".bin", NULL, 0))
+                    break;
+
+                // the snapshot of the same build is likely next to them
+                wcscpy_s(snapshot, _countof(snapshot), buf);
+                temp = wcsstr(snapshot, L"-fingerprints.bin");
+                if (temp)
+                    wcscpy_s(temp, _countof(snapshot) - (temp - snapshot), L"-user.csv");
+
+                if (!Browsefilename(L"Select a snapshot of the same build...", snapshot, NULL, NULL, L".csv", NULL, 0))
+                    break;
+
+                if (index == 40) {
+                    AddSnapshotToCorpus(buf, snapshot);
+                } else {
+                    PortNames(module, buf, snapshot);
+                    Redrawcpudisasm();
+                }
+                break;
+            }
+
+            case 39:
+                AddModuleToCorpus(module);
+                break;
+
+            case 41:
+                LabelFromCorpus(module);
+                Redrawcpudisasm();
+                break;
+
+            case 27:
+                wcscat_s(buf, _countof(buf), L"-user.csv");
+                if (Browsefilename(L"Select a snapshot to browse...", buf, NULL, NULL, L".csv", NULL, 0)) {
+                    BrowseSnapshot(buf);
+                }
+                break;
+
             if (0) {
             case 2:
                 temp = L"-user.csv";
+                name_types = UserNameTypes;
             } else if (0) {
             case 6:
                 temp = L"-system.csv";
+                name_types = SystemNameTypes;
             } else if (0) {
             case 10:
                 temp = L"-func-calls.csv";
+                name_types = FuncCallsNameTypes;
             } else {
             case 14:
                 temp = L"-all.csv";
+                name_types = AllNameTypes;
             }
                 wcscat_s(buf, _countof(buf), temp);
-                LoadFromFile(module, buf);
+                LoadFromFile(module, buf, name_types, exactrestore);
                 break;
 
             if (0) {
             case 3:
                 temp = L"-user.csv";
+                name_types = UserNameTypes;
             } else if (0) {
             case 7:
                 temp = L"-system.csv";
+                name_types = SystemNameTypes;
             } else if (0) {
             case 11:
                 temp = L"-func-calls.csv";
+                name_types = FuncCallsNameTypes;
             } else {
             case 15:
                 temp = L"-all.csv";
+                name_types = AllNameTypes;
             }
                 wcscat_s(buf, _countof(buf), temp);
                 if (Browsefilename(L"Select a User CSV file...", buf, NULL, NULL, L".csv", NULL, 0)) {
-                    LoadFromFile(module, buf);
+                    LoadFromFile(module, buf, name_types, exactrestore);
                 }
                 break;
         }
@@ -402,281 +857,3349 @@ t_menu pluginmenu[] = {
         NULL,
         { 15 }
     },
-    /*{
-        L"Save Smart System Labels to MODULE-user.csv",
+    {
+        L"Save All &Profiles to MODULE-{user,system,func-calls,all}.csv",
         NULL,
         K_NONE,
         menucb,
         NULL,
         { 16 }
-    },*/
+    },
     {
+        L"Save All Profiles to MODULE-{user,system,func-calls,all}-YYYYMMDD_HHMMSS.csv",
+        NULL,
+        K_NONE,
+        menucb,
         NULL,
+        { 17 }
+    },
+    {
+        L"Save User Labels of All Modules to MODULE-modules.csv",
         NULL,
         K_NONE,
+        menucb,
         NULL,
+        { 21 }
+    },
+    {
+        L"Load User Labels of All Modules from MODULE-modules.csv",
         NULL,
-        { 0 }
-    }
-};
-
-t_menu mainmenu[] = {
+        K_NONE,
+        menucb,
+        NULL,
+        { 22 }
+    },
     {
-        L"&" PLUGINNAME,
-        PLUGINDESC,
+        L"Load User Labels of All Modules from...",
+        NULL,
         K_NONE,
+        menucb,
         NULL,
-        pluginmenu,
-        { 0 }
+        { 23 }
     },
     {
+        L"Sea&rch Snapshot Names...",
+        NULL,
+        K_NONE,
+        menucb,
         NULL,
+        { 26 }
+    },
+    {
+        L"&Browse Snapshot...",
         NULL,
         K_NONE,
+        menucb,
         NULL,
+        { 27 }
+    },
+    {
+        L"Snapshot &History...",
         NULL,
-        { 0 }
-    }
-};
-
-bool backup_save_2(const char *filename, rva_t *rvas, char *message)
-{
-    FILE *fh = fopen(filename, "wb");
-
-    if (!fh) {
-        sprintf(message, "File %s could not be opened for writing", filename);
-        return false;
-    }
-
-    if (!rvas) {
-        strcpy(message, "Nothing to save");
-        return false;
-    }
-
-    fprintf(fh, "RVA,label_type,label\r\n");
-
-    int labels = 0;
-    int comments = 0;
-    int exports = 0;
-    int demangled_exports = 0;
-    int imports = 0;
-    int demangled_imports = 0;
-    int debugs = 0;
-    int demangled_debugs = 0;
-    int analysis_labels = 0;
-    int analysis_comments = 0;
-    int parameters = 0;
-    int func_calls = 0;
-    int return_types = 0;
-    int modules = 0;
-    int trickies = 0;
-    bool invalid;
-
-    LIST_FOREACH (rvas, rva_t, rva) {
-        invalid = false;
-        switch (rva->raw_type) {
-            case NM_LABEL:      ++labels; break;
-            case NM_COMMENT:    ++comments; break;
-            case NM_EXPORT:     ++exports; break;
-            case NM_DEEXP:      ++demangled_exports; break;
-            case NM_IMPORT:     ++imports; break;
-            case NM_DEIMP:      ++demangled_imports; break;
-            case NM_DEBUG:      ++debugs; break;
-            case NM_DEDEBUG:    ++demangled_debugs; break;
-            case NM_ANLABEL:    ++analysis_labels; break;
-            case NM_ANLABEL + 1:  /*--rva->raw_type;*/ break;
-            case NM_ANALYSE:    ++analysis_comments; break;
-            case NM_MARK:       ++parameters; break;
-            case NM_CALLED:     ++func_calls; break;
-            case NM_RETTYPE:    ++return_types; break;
-            case NM_MODCOMM:    ++modules; break;
-            case NM_TRICK:      ++trickies; break;
-            default:            invalid = true; break;
-        }
-        if (!invalid) {
-            fprintf(fh, "%08X,", rva->address);
-
-            fwrite(AllNameTypes[RawTypeLookup[rva->raw_type]]->type_string, strlen(AllNameTypes[RawTypeLookup[rva->raw_type]]->type_string), 1, fh);
-
-            fwrite(",", 1, 1, fh);
-
-            if (strchr(rva->name, ',') || strchr(rva->name, '"'))
-                csv_fwrite(fh, rva->name, strlen(rva->name));
-            else
-                fwrite(rva->name, strlen(rva->name), 1, fh);
-
-            fwrite("\r\n", 2, 1, fh);
-        }
-    }
-
-    fclose(fh);
-
-    sprintf(message, "Saved %d labels and %d comments to %s", labels, comments, filename);
-    return true;
-}
-
-extc t_menu _export cdecl *ODBG2_Pluginmenu(wchar_t *type)
-{
-    if (lstrcmp(type, PWM_MAIN) == 0) {
-        return mainmenu;
-    }
-
-    return NULL;
-}
-
-static void LoadFromFile(t_module *module, const wchar_t *filename)
-{
-    wchar_t unicode[TEXTLEN];
-    char utf[TEXTLEN];
-
-    char message[1024];
-
-    Unicodetoutf(filename, wcslen(filename), utf, _countof(utf));
-
-    rva_t *rvas = backup_load(utf, message);
-
-    if (rvas == NULL) {
-        Utftounicode(message, strlen(message), unicode, _countof(unicode));
-        Flash(unicode);
-        return;
-    }
-
-    bool invalid;
-    int parse_type;
-
-    LIST_FOREACH (rvas, rva_t, rva) {
-        if (rva->type[0]) {
-            invalid = false;
-            switch (rva->type[0]) {
-                case 'L':   parse_type = NM_LABEL; break;
-                case 'E':   parse_type = NM_EXPORT; break;
-                case 'I':   parse_type = NM_IMPORT; break;
-                case 'P':   parse_type = NM_MARK; break;
-                case 'R':   parse_type = NM_RETTYPE; break;
-                case 'M':   parse_type = NM_MODCOMM; break;
-                case 'T':   parse_type = NM_TRICK; break;
-                case 'C':   parse_type = rva->type[1] == 'A' ? NM_CALLED : NM_COMMENT; break;
-                case 'A':   parse_type = strlen(rva->type) > 9 && rva->type[9] == 'C' ? NM_ANALYSE : NM_ANLABEL; break;
-                case 'D':
-                    if (strlen(rva->type) > 10) {
-                        switch (rva->type[10]) {
-                            case 'I':   parse_type = NM_DEIMP; break;
-                            case 'E':   parse_type = NM_DEEXP; break;
-                            case 'D':   parse_type = NM_DEDEBUG; break;
-                            case 'A':   invalid = true; break;
-                            default:    invalid = true; break;
-                        }
-                    } else {
-                        parse_type = NM_DEBUG;
-                    }
-                    break;
-                default:    invalid = true; break;
-            }
-            /*if (strcmp(rva->type, "LABEL") == 0) {
-                parse_type = NM_LABEL;
-            } else if (strcmp(rva->type, "COMMENT") == 0) {
-                parse_type = NM_COMMENT;
-            } else if (strcmp(rva->type, "EXPORT") == 0) {
-                parse_type = NM_EXPORT;
-            } else if (strcmp(rva->type, "DEMANGLED_EXPORT") == 0) {
-                parse_type = NM_DEEXP;
-            } else if (strcmp(rva->type, "IMPORT") == 0) {
-                parse_type = NM_IMPORT;
-            } else if (strcmp(rva->type, "DEMANGLED_IMPORT") == 0) {
-                parse_type = NM_DEIMP;
-            } else if (strcmp(rva->type, "DEBUG") == 0) {
-                parse_type = NM_DEBUG;
-            } else if (strcmp(rva->type, "DEMANGLED_DEBUG") == 0) {
-                parse_type = NM_DEDEBUG;
-            } else if (strcmp(rva->type, "ANALYSIS_LABEL") == 0) {
-                parse_type = NM_ANLABEL;
-            } else if (strcmp(rva->type, "ANALYSIS_COMMENT") == 0) {
-                parse_type = NM_ANALYSE;
-            } else if (strcmp(rva->type, "PARAMETER") == 0) {
-                parse_type = NM_MARK;
-            } else if (strcmp(rva->type, "CALLS_FUNC") == 0) {
-                parse_type = NM_CALLED;
-            } else if (strcmp(rva->type, "RETURN_TYPE") == 0) {
-                parse_type = NM_RETTYPE;
-            } else if (strcmp(rva->type, "MODULE") == 0) {
-                parse_type = NM_MODCOMM;
-            } else if (strcmp(rva->type, "TRICKY") == 0) {
-                parse_type = NM_TRICK;
-            } else {
-                invalid = true;
-            }*/
-            if (!invalid && rva->name[0]) {
-                Utftounicode(rva->name, strlen(rva->name), unicode, _countof(unicode));
-                QuickinsertnameW(module->base + rva->address, parse_type, unicode);
-            }
-        }
-    }
+        K_NONE,
+        menucb,
+        NULL,
+        { 28 }
+    },
+    {
+        L"Apply Retention Rules to Timestamped Snapshots",
+        NULL,
+        K_NONE,
+        menucb,
+        NULL,
+        { 29 }
+    },
+    {
+        L"Save Analysis to MODULE-analysis.bin",
+        NULL,
+        K_NONE,
+        menucb,
+        NULL,
+        { 32 }
+    },
+    {
+        L"Restore Analysis from MODULE-analysis.bin",
+        NULL,
+        K_NONE,
+        menucb,
+        NULL,
+        { 31 }
+    },
+    {
+        L"Save Data Records to MODULE-data.bin",
+        NULL,
+        K_NONE,
+        menucb,
+        NULL,
+        { 33 }
+    },
+    {
+        L"Load Data Records from MODULE-data.bin",
+        NULL,
+        K_NONE,
+        menucb,
+        NULL,
+        { 34 }
+    },
+    {
+        L"Save Breakpoints and Patches to MODULE-breakpoints.bin",
+        NULL,
+        K_NONE,
+        menucb,
+        NULL,
+        { 35 }
+    },
+    {
+        L"Load Breakpoints and Patches from MODULE-breakpoints.bin",
+        NULL,
+        K_NONE,
+        menucb,
+        NULL,
+        { 36 }
+    },
+    {
+        L"Save Function Fingerprints to MODULE-fingerprints.bin",
+        NULL,
+        K_NONE,
+        menucb,
+        NULL,
+        { 37 }
+    },
+    {
+        L"Port Labels from an Older Build...",
+        NULL,
+        K_NONE,
+        menucb,
+        NULL,
+        { 38 }
+    },
+    {
+        L"|Add Labels to Signature Corpus",
+        NULL,
+        K_NONE,
+        menucb,
+        NULL,
+        { 39 }
+    },
+    {
+        L"Add Snapshot of an Older Build to Signature Corpus...",
+        NULL,
+        K_NONE,
+        menucb,
+        NULL,
+        { 40 }
+    },
+    {
+        L"Label Procedures from Signature Corpus",
+        NULL,
+        K_NONE,
+        menucb,
+        NULL,
+        { 41 }
+    },
+    {
+        L"Automatic Snapshots to MODULE-user-auto.csv",
+        NULL,
+        K_NONE,
+        menucb,
+        NULL,
+        { 18 }
+    },
+    {
+        L"Journal Changes to MODULE-user-journal.log",
+        NULL,
+        K_NONE,
+        menucb,
+        NULL,
+        { 19 }
+    },
+    {
+        L"Embed User Labels in MODULE.udd",
+        NULL,
+        K_NONE,
+        menucb,
+        NULL,
+        { 20 }
+    },
+    {
+        L"Restore Exactly (Remove Names Missing from the File)",
+        NULL,
+        K_NONE,
+        menucb,
+        NULL,
+        { 24 }
+    },
+    {
+        L"Index Snapshots for Search to MODULE-*.idx",
+        NULL,
+        K_NONE,
+        menucb,
+        NULL,
+        { 25 }
+    },
+    {
+        L"Cache Analysis of Every Analysed Module",
+        NULL,
+        K_NONE,
+        menucb,
+        NULL,
+        { 30 }
+    },
+    /*{
+        L"Save Smart System Labels to MODULE-user.csv",
+        NULL,
+        K_NONE,
+        menucb,
+        NULL,
+        { 16 }
+    },*/
+    {
+        NULL,
+        NULL,
+        K_NONE,
+        NULL,
+        NULL,
+        { 0 }
+    }
+};
+
+t_menu mainmenu[] = {
+    {
+        L"&" PLUGINNAME,
+        PLUGINDESC,
+        K_NONE,
+        NULL,
+        pluginmenu,
+        { 0 }
+    },
+    {
+        NULL,
+        NULL,
+        K_NONE,
+        NULL,
+        NULL,
+        { 0 }
+    }
+};
+
+// Index of the raw type in AllNameTypes, -1 if it is not a name type
+static int NameTypeIndex(int raw_type)
+{
+    if (raw_type < NM_LABEL || raw_type >= (int)_countof(RawTypeLookup))
+        return -1;
+
+    return RawTypeLookup[raw_type] - 1;
+}
+
+static unsigned int NameTypeBit(int raw_type)
+{
+    int index = NameTypeIndex(raw_type);
+
+    return index < 0 ? 0 : 1u << index;
+}
+
+static unsigned int NameTypesMask(const NAME_TYPE **Names)
+{
+    unsigned int mask = 0;
+
+    for (int i = 0; Names[i]; i++)
+        mask |= NameTypeBit(Names[i]->type);
+
+    return mask;
+}
+
+// Writes one row of a snapshot, false for types a snapshot does not hold
+static bool WriteSnapshotRow(FILE *fh, unsigned int address, int raw_type, const char *name)
+{
+    const char *type = NameTypeString(raw_type);
+
+    if (!type)
+        return false;
+
+    backup_write_row(fh, address, type, name);
+    STATS_ADD(STATS_RECORDS, 1);
+
+    return true;
+}
+
+bool backup_save_2(const char *filename, rva_t *rvas, unsigned int mask, const identity_t *identity, char *message)
+{
+    if (!rvas) {
+        strcpy(message, "Nothing to save");
+        return false;
+    }
+
+    STATS_ENTER(STATS_IO);
+    FILE *fh = fopen(filename, "wb");
+    STATS_LEAVE(STATS_IO);
+
+    if (!fh) {
+        sprintf(message, "File %s could not be opened for writing", filename);
+        return false;
+    }
+
+    STATS_ENTER(STATS_CSV);
+
+    fprintf(fh, "RVA,label_type,label\r\n");
+
+    if (identity)
+        backup_write_identity(fh, identity);
+
+    int labels = 0;
+    int comments = 0;
+
+    LIST_FOREACH (rvas, rva_t, rva) {
+        if (!(mask & NameTypeBit(rva->raw_type)))
+            continue;
+
+        if (WriteSnapshotRow(fh, rva->address, rva->raw_type, rva->name)) {
+            labels += rva->raw_type == NM_LABEL;
+            comments += rva->raw_type == NM_COMMENT;
+        }
+    }
+
+    STATS_LEAVE(STATS_CSV);
+    STATS_ADD(STATS_BYTES, ftell(fh));
+
+    STATS_ENTER(STATS_IO);
+    fclose(fh);
+    STATS_LEAVE(STATS_IO);
+
+    sprintf(message, "Saved %d labels and %d comments to %s", labels, comments, filename);
+    return true;
+}
+
+// Range a disassembler or dump menu item works on: the selection for even
+// indexes, the procedure around the cursor for odd ones
+static t_module *MenuRange(t_table *pt, ulong index, ulong *addr0, ulong *addr1)
+{
+    t_dump *pd = pt ? (t_dump *)pt->customdata : NULL;
+
+    if (!pd)
+        return NULL;
+
+    if (index & 1) {
+        // amax is the last byte of the procedure
+        if (Getproclimits(pd->sel0, addr0, addr1) != 0)
+            return NULL;
+        (*addr1)++;
+    } else {
+        *addr0 = pd->sel0;
+        *addr1 = pd->sel1 > pd->sel0 ? pd->sel1 : pd->sel0 + 1;
+    }
+
+    t_module *module = Findmodule(*addr0);
+
+    if (!module || *addr0 < module->base)
+        return NULL;
+
+    if (*addr1 > module->base + module->size)
+        *addr1 = module->base + module->size;
+
+    return module;
+}
+
+static int RangeMenufunc(t_table *pt, wchar_t *name, ulong index, int mode)
+{
+    ulong addr0, addr1;
+
+    if (!initialized)
+        return MENU_ABSENT;
+
+    t_module *module = MenuRange(pt, index, &addr0, &addr1);
+
+    if (!module)
+        return MENU_GRAYED;
+
+    if (mode == MENU_VERIFY)
+        return MENU_NORMAL;
+
+    if (mode != MENU_EXECUTE)
+        return MENU_ABSENT;
+
+    wchar_t buf[MAXPATH];
+    wcscpy_s(buf, _countof(buf), module->path);
+
+    wchar_t *last_stop = wcsrchr(buf, L'.');
+    if (!last_stop)
+        return MENU_ABSENT;
+
+    *last_stop = L'\0';
+
+    if (index < 2) {
+        wchar_t suffix[32];
+        swprintf(suffix, _countof(suffix), L"-user-%08X.csv", addr0 - module->base);
+        wcscat_s(buf, _countof(buf), suffix);
+
+        if (Browsefilename(L"Export names to...", buf, NULL, NULL, L".csv", NULL, BRO_SAVE))
+            ExportRangeToFile(module, addr0, addr1, buf);
+    } else {
+        wcscat_s(buf, _countof(buf), L"-user.csv");
+
+        if (Browsefilename(L"Import names from...", buf, NULL, NULL, L".csv", NULL, 0))
+            LoadRangeFromFile(module, addr0, addr1, buf, UserNameTypes, exactrestore);
+    }
+
+    return MENU_REDRAW;
+}
+
+static t_menu rangesubmenu[] = {
+    { L"Export Selection...", L"Save the user labels and comments of the selection", K_NONE, RangeMenufunc, NULL, { 0 } },
+    { L"Export Procedure...", L"Save the user labels and comments of the procedure", K_NONE, RangeMenufunc, NULL, { 1 } },
+    { L"|Import into Selection...", L"Load the names of a snapshot that fall in the selection", K_NONE, RangeMenufunc, NULL, { 2 } },
+    { L"Import into Procedure...", L"Load the names of a snapshot that fall in the procedure", K_NONE, RangeMenufunc, NULL, { 3 } },
+    { NULL, NULL, K_NONE, NULL, NULL, { 0 } }
+};
+
+static t_menu rangemenu[] = {
+    { L"|" PLUGINNAME, PLUGINDESC, K_NONE, NULL, rangesubmenu, { 0 } },
+    { NULL, NULL, K_NONE, NULL, NULL, { 0 } }
+};
+
+extc t_menu _export cdecl *ODBG2_Pluginmenu(wchar_t *type)
+{
+    if (lstrcmp(type, PWM_MAIN) == 0) {
+        return mainmenu;
+    }
+
+    if (lstrcmp(type, PWM_DISASM) == 0 || lstrcmp(type, PWM_DUMP) == 0) {
+        return rangemenu;
+    }
+
+    return NULL;
+}
+
+// The raw type of a type string as written by the plugin, -1 if unknown
+static int ParseNameType(const char *type)
+{
+    for (int i = 0; AllNameTypes[i]; i++) {
+        if (strcmp(AllNameTypes[i]->type_string, type) == 0)
+            return AllNameTypes[i]->type;
+    }
+
+    return -1;
+}
+
+// The type string of a raw type, NULL if it is not a name type
+static const char *NameTypeString(int type)
+{
+    int index = NameTypeIndex(type);
+
+    return index < 0 ? NULL : AllNameTypes[index]->type_string;
+}
+
+typedef struct JOIN_STATS {
+    int unchanged;
+    int changed;
+    int added;
+    int removed;
+} JOIN_STATS;
+
+// Merge-joins the sorted snapshot with the sorted live names. With insert set
+// the new and changed names are handed to OllyDbg, otherwise they are counted.
+static void JoinNames(t_module *module, const names_t *snapshot, const names_t *live, bool insert, JOIN_STATS *stats)
+{
+    int i = 0;
+    int j = 0;
+
+    memset(stats, 0, sizeof(JOIN_STATS));
+
+    while (i < snapshot->count || j < live->count) {
+        // rows were prepended while loading, so the first of a run is the
+        // last one in the file
+        if (i > 0 && i < snapshot->count &&
+            snapshot->items[i].address == snapshot->items[i - 1].address &&
+            snapshot->items[i].type == snapshot->items[i - 1].type) {
+            i++;
+            continue;
+        }
+
+        int cmp;
+
+        if (i == snapshot->count) {
+            cmp = 1;
+        } else if (j == live->count) {
+            cmp = -1;
+        } else if (snapshot->items[i].address != live->items[j].address) {
+            cmp = snapshot->items[i].address < live->items[j].address ? -1 : 1;
+        } else {
+            cmp = snapshot->items[i].type - live->items[j].type;
+        }
+
+        if (cmp > 0) {
+            stats->removed++;
+            j++;
+            continue;
+        }
+
+        const char *name = NAMES_STR(snapshot, i);
+
+        if (cmp == 0) {
+            bool same = strcmp(NAMES_STR(live, j), name) == 0;
+            j++;
+            if (same) {
+                stats->unchanged++;
+                i++;
+                continue;
+            }
+            stats->changed++;
+        } else {
+            stats->added++;
+        }
+
+        if (insert)
+            engine_insert(module->base + snapshot->items[i].address, snapshot->items[i].type, name);
+
+        i++;
+    }
+}
+
+// Brings addr0..addr1 of the module in line with the sorted snapshot, which
+// must not hold names outside of it nor the mangled analysis label pseudo
+// type, every type is handed to OllyDbg. Only new and changed names are
+// inserted.
+// An exact restore also drops every name of the profile types that is not in
+// the snapshot, by clearing the range and inserting the snapshot again.
+static void ApplyNames(t_module *module, ulong addr0, ulong addr1, const names_t *snapshot, const NAME_TYPE **Names, bool exact, JOIN_STATS *stats)
+{
+    bool seen[_countof(RawTypeLookup)] = { false };
+    int list[_countof(RawTypeLookup)];
+    int n = 0;
+
+    if (exact) {
+        n = NameTypeList(Names, list);
+        for (int i = 0; i < n; i++)
+            seen[list[i]] = true;
+    }
+
+    for (int i = 0; i < snapshot->count; i++) {
+        int type = snapshot->items[i].type;
+        if (!seen[type]) {
+            seen[type] = true;
+            list[n++] = type;
+        }
+    }
+
+    names_t live = { 0 };
+    EnumerateNameRange(module, addr0, addr1, list, n, &live);
+
+    JoinNames(module, snapshot, &live, !exact, stats);
+
+    if (exact) {
+        if (stats->removed) {
+            STATS_ENTER(STATS_APPLY);
+            Deletedatarangelist(addr0, addr1, list, n);
+            STATS_LEAVE(STATS_APPLY);
+            STATS_ADD(STATS_CALLS, 1);
+
+            for (int i = 0; i < snapshot->count; i++) {
+                if (i > 0 && snapshot->items[i].address == snapshot->items[i - 1].address &&
+                    snapshot->items[i].type == snapshot->items[i - 1].type)
+                    continue;
+
+                engine_insert(module->base + snapshot->items[i].address, snapshot->items[i].type, NAMES_STR(snapshot, i));
+            }
+        } else {
+            // nothing to remove, only the differences need to go in
+            JoinNames(module, snapshot, &live, true, stats);
+        }
+    }
+
+    names_free(&live);
+
+    // names are only ever removed by an exact restore
+    if (stats->changed || stats->added || (exact && stats->removed))
+        engine_merge();
+}
+
+// Sorted names of the rows that have a known type, returns the number of
+// rows whose type is not known
+static int SnapshotNames(rva_t *rvas, names_t *names)
+{
+    int unknown = 0;
+
+    LIST_FOREACH (rvas, rva_t, rva) {
+        if (rva->type[0]) {
+            int parse_type = ParseNameType(rva->type);
+            if (parse_type < 0)
+                unknown++;
+            else if (rva->name[0])
+                names_add(names, rva->address, parse_type, rva->name);
+        }
+    }
+
+    names_sort(names);
+
+    return unknown;
+}
+
+// Whether names saved from the build of saved may go into the module, asks
+// when the builds differ
+static bool ConfirmIdentity(t_module *module, const identity_t *saved, const wchar_t *filename)
+{
+    identity_t current;
+
+    // older snapshots carry no identity and are applied as before
+    if (!saved->size || !backup_identity(module->path, &current))
+        return true;
+
+    int differ = backup_compare_identity(saved, &current);
+    int answer;
+
+    if (differ == 0)
+        return true;
+
+    if (differ == IDENTITY_LAYOUT) {
+        answer = Condyesno(NULL, PLUGINNAME, L"%s was saved from a different build of %s with another section layout.\n\nApply its labels anyway?", filename, module->modname);
+    } else if (differ == IDENTITY_OUTSIDE) {
+        answer = Condyesno(NULL, PLUGINNAME, L"%s was saved from a different build of %s with the same sections, the rest of the file differs.\n\nApply its labels anyway?", filename, module->modname);
+    } else {
+        answer = Condyesno(NULL, PLUGINNAME, L"%s was saved from a different build of %s, %d of %d sections differ.\n\nApply its labels anyway?", filename, module->modname, differ, current.nsections);
+    }
+
+    return answer == IDYES;
+}
+
+static void LoadFromFile(t_module *module, const wchar_t *filename, const NAME_TYPE **Names, bool exact)
+{
+    LoadRangeFromFile(module, module->base, module->base + module->size, filename, Names, exact);
+}
+
+// Applies the names of a snapshot that fall in addr0..addr1 of the module
+static void LoadRangeFromFile(t_module *module, ulong addr0, ulong addr1, const wchar_t *filename, const NAME_TYPE **Names, bool exact)
+{
+    wchar_t unicode[TEXTLEN];
+    char utf[TEXTLEN];
+
+    char message[1024];
+
+    Unicodetoutf(filename, wcslen(filename), utf, _countof(utf));
+
+    STATS_BEGIN("load");
+
+    identity_t saved;
+
+    rva_t *rvas = backup_load(utf, &saved, message);
+
+    if (rvas == NULL) {
+        Utftounicode(message, strlen(message), unicode, _countof(unicode));
+        Flash(unicode);
+        return;
+    }
+
+    if (!ConfirmIdentity(module, &saved, filename)) {
+        LIST_FREE(rvas);
+        Flash(L"Load cancelled, module identity does not match");
+        return;
+    }
+
+    names_t snapshot = { 0 };
+    int unknown = SnapshotNames(rvas, &snapshot);
+    LIST_FREE(rvas);
+
+    // an exact restore would delete every name of a row it can't read
+    if (exact && unknown) {
+        names_free(&snapshot);
+        Flash(L"Restore cancelled, %s has %d rows of an unknown name type", filename, unknown);
+        return;
+    }
+
+    int kept = 0;
+
+    // sorted, so dropping rows in place keeps it sorted; rows past the end of
+    // the module are dropped too, ApplyNames only handles the range. The
+    // mangled analysis label is not a type OllyDbg takes, its demangled
+    // ANALYSIS_LABEL row is applied instead.
+    for (int i = 0; i < snapshot.count; i++) {
+        ulong addr = module->base + snapshot.items[i].address;
+        if (snapshot.items[i].type != NM_ANLABEL + 1 &&
+            snapshot.items[i].address < module->size && addr >= addr0 && addr < addr1)
+            snapshot.items[kept++] = snapshot.items[i];
+    }
+
+    snapshot.count = kept;
+
+    JOIN_STATS stats;
+    ApplyNames(module, addr0, addr1, &snapshot, Names, exact, &stats);
+
+    if (exact) {
+        Info(L"Restored %d names from %s: %d unchanged, %d changed, %d new, %d removed",
+             stats.unchanged + stats.changed + stats.added, filename,
+             stats.unchanged, stats.changed, stats.added, stats.removed);
+    } else {
+        Info(L"Loaded %d names from %s: %d unchanged, %d changed, %d new",
+             stats.unchanged + stats.changed + stats.added, filename,
+             stats.unchanged, stats.changed, stats.added);
+    }
+
+    names_free(&snapshot);
+
+    ReportStats(utf);
+}
+
+// One snapshot file of an export, its rows are the names of its types
+typedef struct EXPORT_FILE {
+    char utf[MAXPATH];
+    const NAME_TYPE **Names;
+    FILE *fh;
+    unsigned int mask;
+    int labels;
+    int comments;
+    catalog_t entry;
+    int counts[_countof(AllNameTypes)];
+    names_t index;
+    bool indexed;
+} EXPORT_FILE;
+
+typedef struct EXPORT_STATE {
+    const int *list;
+    int n;
+    spill_t spill;
+    bool failed;
+    char *message;
+    EXPORT_FILE *files;
+    int nfiles;
+} EXPORT_STATE;
+
+// Names are sorted by address and then by the reverse of the type list,
+// the order engine_collect returns them in. The raw type is kept in the
+// low byte.
+static void ExportCollectRow(void *data, unsigned int rva, int index, const char *name)
+{
+    EXPORT_STATE *st = data;
+
+    if (!st->failed && !spill_add(&st->spill, rva, (st->n - 1 - index) << 8 | st->list[index], name, st->message))
+        st->failed = true;
+}
+
+static void ExportWriteRow(void *data, unsigned int address, int type, const char *name)
+{
+    EXPORT_STATE *st = data;
+    int raw_type = type & 0xFF;
+
+    for (int i = 0; i < st->nfiles; i++) {
+        EXPORT_FILE *file = &st->files[i];
+
+        if (!(file->mask & NameTypeBit(raw_type)) || !WriteSnapshotRow(file->fh, address, raw_type, name))
+            continue;
+
+        file->labels += raw_type == NM_LABEL;
+        file->comments += raw_type == NM_COMMENT;
+
+        CatalogCount(&file->entry, file->counts, address, raw_type, name);
+
+        if (file->indexed)
+            names_add(&file->index, address, raw_type, name);
+    }
+}
+
+// Saves snapshots within exportbudget megabytes of heap. The names of the
+// Names types are collected once and sorted through spill, which writes
+// sorted runs to disk once they take half of the budget. The runs are
+// merged once, each row going to every file whose types include it.
+static bool ExportFiles(t_module *module, EXPORT_FILE *files, int nfiles, const NAME_TYPE **Names, char *message)
+{
+    int list[_countof(RawTypeLookup)];
+    char path[MAXPATH];
+    EXPORT_STATE st;
+
+    memset(&st, 0, sizeof st);
+    st.list = list;
+    st.n = NameTypeList(Names, list);
+    st.message = message;
+    st.files = files;
+    st.nfiles = nfiles;
+
+    spill_init(&st.spill, files[0].utf, (size_t)exportbudget << 20);
+
+    anlabeladdress = 0;
+    engine_visit(module->base, module->size, list, st.n, ExportCollectRow, &st);
+
+    if (st.failed) {
+        spill_free(&st.spill);
+        return false;
+    }
+
+    if (st.spill.runs == 0 && st.spill.names.count == 0) {
+        spill_free(&st.spill);
+        strcpy(message, "Nothing to save");
+        return false;
+    }
+
+    identity_t identity;
+    bool known = backup_identity(module->path, &identity);
+    int runs = st.spill.runs + (st.spill.runs && st.spill.names.count);
+
+    for (int i = 0; i < nfiles; i++) {
+        EXPORT_FILE *file = &files[i];
+
+        STATS_ENTER(STATS_IO);
+        file->fh = fopen(file->utf, "wb");
+        STATS_LEAVE(STATS_IO);
+
+        if (!file->fh) {
+            while (i--)
+                fclose(files[i].fh);
+
+            spill_free(&st.spill);
+            sprintf(message, "File %s could not be opened for writing", file->utf);
+            return false;
+        }
+
+        fprintf(file->fh, "RVA,label_type,label\r\n");
+
+        if (known)
+            backup_write_identity(file->fh, &identity);
+
+        // a snapshot too large to sort in memory is too large to index too
+        file->mask = NameTypesMask(file->Names);
+        file->indexed = indexsnapshots && !runs;
+        file->entry.hash = BACKUP_HASH_INIT;
+    }
+
+    STATS_ENTER(STATS_CSV);
+    bool ok = spill_finish(&st.spill, ExportWriteRow, &st, message);
+    STATS_LEAVE(STATS_CSV);
+
+    for (int i = 0; i < nfiles; i++) {
+        STATS_ADD(STATS_BYTES, ftell(files[i].fh));
+
+        STATS_ENTER(STATS_IO);
+        fclose(files[i].fh);
+        STATS_LEAVE(STATS_IO);
+    }
+
+    if (!ok) {
+        for (int i = 0; i < nfiles; i++)
+            names_free(&files[i].index);
+        return false;
+    }
+
+    ReportStats(files[0].utf);
+
+    if (runs)
+        Addtolist(0, DRAW_NORMAL, L"Snapshot sorted in %d runs within %d MB, not indexed", runs, exportbudget);
+
+    for (int i = 0; i < nfiles; i++) {
+        EXPORT_FILE *file = &files[i];
+
+        // an index left from an earlier save would no longer match the rows
+        if (file->indexed) {
+            names_sort(&file->index);
+            IndexNames(file->utf, &file->index);
+        } else {
+            search_index_path(path, sizeof path, file->utf);
+            DeleteFileA(path);
+        }
+
+        names_free(&file->index);
+
+        CatalogWrite(module, file->utf, &file->entry, file->counts, file->Names, known ? &identity : NULL);
+    }
+
+    ApplyRetention(module, false);
+
+    return true;
+}
+
+static bool ExportToFile(t_module *module, const wchar_t *filename, const NAME_TYPE** Names, char *message)
+{
+    EXPORT_FILE file;
+
+    STATS_BEGIN("save");
+
+    memset(&file, 0, sizeof file);
+    file.Names = Names;
+    Unicodetoutf(filename, wcslen(filename), file.utf, _countof(file.utf));
+
+    if (!ExportFiles(module, &file, 1, Names, message))
+        return false;
+
+    sprintf(message, "Saved %d labels and %d comments to %s", file.labels, file.comments, file.utf);
+
+    return true;
+}
+
+// Saves the user labels and comments in addr0..addr1. The file has the
+// format of a snapshot but is not indexed or cataloged, it only covers part
+// of the module.
+static void ExportRangeToFile(t_module *module, ulong addr0, ulong addr1, const wchar_t *filename)
+{
+    wchar_t unicode[TEXTLEN];
+    char utf[MAXPATH];
+    char message[1024];
+    int list[_countof(RawTypeLookup)];
+    int n = NameTypeList(UserNameTypes, list);
+    names_t names = { 0 };
+    rva_t *rvas = NULL;
+
+    EnumerateNameRange(module, addr0, addr1, list, n, &names);
+
+    // from the top down, so the list ends up in address order
+    for (int i = names.count - 1; i >= 0; i--) {
+        rva_t *rva = malloc(sizeof(rva_t));
+        rva->address = names.items[i].address;
+        rva->raw_type = names.items[i].type;
+        snprintf(rva->name, sizeof(rva->name), "%s", NAMES_STR(&names, i));
+        LIST_INSERT(rvas, rva);
+    }
+
+    names_free(&names);
+
+    Unicodetoutf(filename, wcslen(filename), utf, _countof(utf));
+
+    identity_t identity;
+    bool known = backup_identity(module->path, &identity);
+
+    bool ret = backup_save_2(utf, rvas, NameTypesMask(UserNameTypes), known ? &identity : NULL, message);
+
+    LIST_FREE(rvas);
+
+    Utftounicode(message, strlen(message), unicode, _countof(unicode));
+
+    if (ret)
+        Info(L"%08X..%08X: %s", addr0, addr1, unicode);
+    else
+        Flash(unicode);
+}
+
+static void SaveToFile(t_module *module, const wchar_t *filename, const NAME_TYPE** Names)
+{
+    if (Names) {
+        wchar_t unicode[TEXTLEN];
+        char message[1024];
+
+        if (ExportToFile(module, filename, Names, message)) {
+            Utftounicode(message, strlen(message), unicode, _countof(unicode));
+            Info(unicode);
+        } else {
+            Utftounicode(message, strlen(message), unicode, _countof(unicode));
+            Flash(unicode);
+        }
+    } else {
+        Flash(L"Internal name type error");
+    }
+}
+
+static void SaveProfilesToFiles(t_module *module, const wchar_t *basename, const wchar_t *stamp)
+{
+    EXPORT_FILE files[_countof(Profiles) - 1];
+    wchar_t unicode[TEXTLEN];
+    wchar_t filename[MAXPATH];
+    char message[1024];
+    int n = 0;
+
+    STATS_BEGIN("save profiles");
+
+    memset(files, 0, sizeof files);
+
+    for (const PROFILE *profile = Profiles; profile->suffix; profile++, n++) {
+        wcscpy_s(filename, _countof(filename), basename);
+        wcscat_s(filename, _countof(filename), profile->suffix);
+        wcscat_s(filename, _countof(filename), stamp);
+        wcscat_s(filename, _countof(filename), L".csv");
+
+        files[n].Names = profile->types;
+        Unicodetoutf(filename, wcslen(filename), files[n].utf, _countof(files[n].utf));
+    }
+
+    // AllNameTypes is a superset of every other profile, so one scan feeds them all
+    if (!ExportFiles(module, files, n, AllNameTypes, message)) {
+        Utftounicode(message, strlen(message), unicode, _countof(unicode));
+        Flash(unicode);
+        return;
+    }
+
+    Info(L"Saved %d profiles to %s-*%s.csv", n, basename, stamp);
+}
+
+#ifdef BACKUP_STATS
+static void StatsLine(void *data, const char *text)
+{
+    wchar_t unicode[TEXTLEN];
+
+    Utftounicode(text, strlen(text), unicode, _countof(unicode));
+    Addtolist(0, DRAW_NORMAL, L"%s", unicode);
+}
+#endif
+
+// Logs where the time of the last save or load went, and with "Statistics
+// files" set writes it to SNAPSHOT.stats.json too. Empty unless built with
+// BACKUP_STATS.
+static void ReportStats(const char *filename)
+{
+#ifdef BACKUP_STATS
+    char json[MAXPATH];
+
+    if (statsfiles && snprintf(json, sizeof json, "%s.stats.json", filename) < (int)sizeof json)
+        STATS_REPORT(StatsLine, NULL, json);
+    else
+        STATS_REPORT(StatsLine, NULL, NULL);
+#else
+    (void)filename;
+#endif
+}
+
+// Writes the search index of a snapshot next to it, a failure only costs
+// the search so it is logged rather than flashed
+static void IndexNames(const char *filename, const names_t *names)
+{
+    char path[MAXPATH];
+    char message[1024];
+    wchar_t unicode[TEXTLEN];
+
+    search_index_path(path, sizeof path, filename);
+
+    if (!search_write(path, names, message)) {
+        Utftounicode(message, strlen(message), unicode, _countof(unicode));
+        Addtolist(0, DRAW_HILITE, L"%s", unicode);
+    }
+}
+
+// UTF-8 path of MODULE followed by suffix, next to the module
+static void ModuleFilePath(t_module *module, const wchar_t *suffix, char *dst, size_t size)
+{
+    wchar_t path[MAXPATH];
+    wcscpy_s(path, _countof(path), module->path);
+
+    wchar_t *last_stop = wcsrchr(path, L'.');
+    if (last_stop)
+        *last_stop = L'\0';
+
+    wcscat_s(path, _countof(path), suffix);
+    Unicodetoutf(path, wcslen(path), dst, size);
+}
+
+// Counts a row written to a snapshot for its catalog entry
+static void CatalogCount(catalog_t *entry, int *counts, unsigned int address, int raw_type, const char *name)
+{
+    counts[NameTypeIndex(raw_type)]++;
+    entry->names++;
+
+    entry->hash = backup_hash(entry->hash, &address, sizeof address);
+    entry->hash = backup_hash(entry->hash, &raw_type, sizeof raw_type);
+    entry->hash = backup_hash(entry->hash, name, strlen(name));
+}
+
+// Records a saved snapshot whose rows were counted with CatalogCount
+static void CatalogWrite(t_module *module, const char *filename, catalog_t *entry, const int *counts, const NAME_TYPE **Names, const identity_t *identity)
+{
+    char path[MAXPATH];
+    char message[1024];
+    SYSTEMTIME now;
+
+    const char *base = strrchr(filename, '\\');
+    strncpy(entry->file, base ? base + 1 : filename, sizeof entry->file - 1);
+
+    GetLocalTime(&now);
+    snprintf(entry->saved, sizeof entry->saved, "%04d-%02d-%02d %02d:%02d:%02d",
+             now.wYear, now.wMonth, now.wDay, now.wHour, now.wMinute, now.wSecond);
+
+    for (const PROFILE *profile = Profiles; profile->suffix; profile++) {
+        if (profile->types == Names)
+            Unicodetoutf(profile->suffix + 1, wcslen(profile->suffix + 1), entry->profile, sizeof entry->profile);
+    }
+
+    size_t used = 0;
+
+    for (int i = 0; AllNameTypes[i]; i++) {
+        if (counts[i] && used < sizeof entry->counts) {
+            used += snprintf(entry->counts + used, sizeof entry->counts - used, "%s%s=%d",
+                             used ? " " : "", AllNameTypes[i]->type_string, counts[i]);
+        }
+    }
+
+    if (identity)
+        backup_identity_string(identity, entry->identity, sizeof entry->identity);
+
+    WIN32_FILE_ATTRIBUTE_DATA attr;
+    wchar_t unicode[MAXPATH];
+
+    Utftounicode(filename, strlen(filename), unicode, _countof(unicode));
+    if (GetFileAttributesExW(unicode, GetFileExInfoStandard, &attr))
+        entry->size = attr.nFileSizeLow;
+
+    ModuleFilePath(module, L"-catalog.csv", path, sizeof path);
+
+    if (!catalog_update(path, entry, message)) {
+        Utftounicode(message, strlen(message), unicode, _countof(unicode));
+        Addtolist(0, DRAW_HILITE, L"%s", unicode);
+    }
+}
+
+// Thins out the timestamped snapshots of the module in the background,
+// the catalog says which ones without opening them
+static void ApplyRetention(t_module *module, bool verbose)
+{
+    char path[MAXPATH];
+
+    if (closing)
+        return;
+
+    if (!retention_enabled(&retention)) {
+        if (verbose)
+            Flash(L"No retention rules are set in the %s section of ollydbg.ini", PLUGINNAME);
+        return;
+    }
+
+    ModuleFilePath(module, L"-catalog.csv", path, sizeof path);
+
+    // a worker that is still busy picks the new snapshots up next time
+    if (!retention_start(&retentionjob, path, &retention)) {
+        if (verbose)
+            Flash(L"Retention is already running");
+        return;
+    }
+
+    if (verbose)
+        Info(L"Applying the retention rules to the snapshots of %s", module->modname);
+}
+
+static void ReapRetention(DWORD timeout)
+{
+    char message[1024];
+    wchar_t unicode[TEXTLEN];
+
+    if (retention_finish(&retentionjob, timeout, message) > 0) {
+        Utftounicode(message, strlen(message), unicode, _countof(unicode));
+        Addtolist(0, DRAW_NORMAL, L"%s", unicode);
+    }
+}
+
+typedef struct SEARCH_RESULT {
+    t_sorthdr hdr;              // addr is the result number
+    ulong rva;
+    wchar_t type[SHORTNAME];
+    wchar_t name[TEXTLEN];
+    wchar_t snapshot[SHORTNAME];
+} SEARCH_RESULT;
+
+static int SearchSortfunc(const t_sorthdr *sh1, const t_sorthdr *sh2, const int sort)
+{
+    const SEARCH_RESULT *a = (const SEARCH_RESULT *)sh1;
+    const SEARCH_RESULT *b = (const SEARCH_RESULT *)sh2;
+    int ret = 0;
+
+    switch (sort) {
+        case 0: ret = a->rva < b->rva ? -1 : a->rva > b->rva; break;
+        case 1: ret = wcscmp(a->type, b->type); break;
+        case 2: ret = _wcsicmp(a->name, b->name); break;
+        case 3: ret = wcscmp(a->snapshot, b->snapshot); break;
+    }
+
+    if (ret == 0)
+        ret = a->hdr.addr < b->hdr.addr ? -1 : a->hdr.addr > b->hdr.addr;
+
+    return ret;
+}
+
+static int SearchDrawfunc(wchar_t *s, uchar *mask, int *select, t_table *pt, t_sorthdr *ps, int column, void *cache)
+{
+    const SEARCH_RESULT *result = (const SEARCH_RESULT *)ps;
+    t_module *module = Findmainmodule();
+
+    switch (column) {
+        case 0:
+            return swprintf(s, TEXTLEN, L"%08X", (module ? module->base : 0) + result->rva);
+        case 1:
+            return swprintf(s, TEXTLEN, L"%s", result->type);
+        case 2:
+            return swprintf(s, TEXTLEN, L"%s", result->name);
+        case 3:
+            return swprintf(s, TEXTLEN, L"%s", result->snapshot);
+        default:
+            return 0;
+    }
+}
+
+static long SearchTabfunc(t_table *pt, HWND hw, UINT msg, WPARAM wp, LPARAM lp)
+{
+    if (msg == WM_USER_DBLCLK) {
+        const SEARCH_RESULT *result = Getsortedbyselection(&pt->sorted, pt->sorted.selected);
+        t_module *module = Findmainmodule();
+
+        if (result && module)
+            Setcpu(0, module->base + result->rva, 0, 0, 0, CPU_ASMHIST | CPU_ASMCENTER | CPU_ASMFOCUS);
+
+        return 1;
+    }
+
+    return 0;
+}
+
+static void InitSearchTable(void)
+{
+    if (searchtable.sorted.itemsize)
+        return;
+
+    wcscpy_s(searchtable.name, _countof(searchtable.name), L"Snapshot search");
+    searchtable.mode = TABLE_SAVEPOS | TABLE_SAVECOL;
+    searchtable.bar.visible = 1;
+    searchtable.bar.nbar = 4;
+
+    searchtable.bar.name[0] = L"Address";
+    searchtable.bar.expl[0] = L"Address of the name in the loaded module";
+    searchtable.bar.mode[0] = BAR_SORT;
+    searchtable.bar.defdx[0] = 9;
+
+    searchtable.bar.name[1] = L"Type";
+    searchtable.bar.expl[1] = L"Type of the name";
+    searchtable.bar.mode[1] = BAR_SORT;
+    searchtable.bar.defdx[1] = 18;
+
+    searchtable.bar.name[2] = L"Name";
+    searchtable.bar.expl[2] = L"Label or comment";
+    searchtable.bar.mode[2] = BAR_SORT;
+    searchtable.bar.defdx[2] = 48;
+
+    searchtable.bar.name[3] = L"Snapshot";
+    searchtable.bar.expl[3] = L"Snapshot the name was found in";
+    searchtable.bar.mode[3] = BAR_SORT;
+    searchtable.bar.defdx[3] = 24;
+
+    searchtable.tabfunc = SearchTabfunc;
+    searchtable.drawfunc = SearchDrawfunc;
+
+    Createsorteddata(&searchtable.sorted, sizeof(SEARCH_RESULT), 256, SearchSortfunc, NULL, 0);
+}
+
+typedef struct INDEX_VIEW {
+    HANDLE file;
+    HANDLE mapping;
+    const void *view;
+    search_t index;
+} INDEX_VIEW;
+
+// Maps a whole .idx file, rows are read straight from the mapping
+static bool OpenIndexView(const wchar_t *path, INDEX_VIEW *iv)
+{
+    memset(iv, 0, sizeof(INDEX_VIEW));
+
+    iv->file = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (iv->file == INVALID_HANDLE_VALUE) {
+        iv->file = NULL;
+        return false;
+    }
+
+    DWORD size = GetFileSize(iv->file, NULL);
+    iv->mapping = size ? CreateFileMappingW(iv->file, NULL, PAGE_READONLY, 0, 0, NULL) : NULL;
+    iv->view = iv->mapping ? MapViewOfFile(iv->mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+
+    return iv->view && search_open(&iv->index, iv->view, size);
+}
+
+static void CloseIndexView(INDEX_VIEW *iv)
+{
+    if (iv->view)
+        UnmapViewOfFile(iv->view);
+    if (iv->mapping)
+        CloseHandle(iv->mapping);
+    if (iv->file)
+        CloseHandle(iv->file);
+
+    memset(iv, 0, sizeof(INDEX_VIEW));
+}
+
+// Looks up the pattern in one index, returns the names added
+static int SearchIndexFile(const wchar_t *path, const wchar_t *snapshot, const char *pattern, int flags, int max)
+{
+    INDEX_VIEW iv;
+    int found = 0;
+
+    if (OpenIndexView(path, &iv)) {
+        int *results = malloc(max * sizeof(int));
+
+        found = results ? search_find(&iv.index, pattern, flags, results, max, NULL) : 0;
+
+        for (int i = 0; i < found; i++) {
+            const search_record_t *record = &iv.index.records[results[i]];
+            const char *name = SEARCH_STR(&iv.index, results[i]);
+            SEARCH_RESULT result = { { searchtable.sorted.n + 1, 1, 0 }, record->address };
+
+            if (NameTypeBit(record->type)) {
+                const char *type = NameTypeString(record->type);
+                Utftounicode(type, strlen(type), result.type, _countof(result.type));
+            }
+
+            Utftounicode(name, strlen(name), result.name, _countof(result.name));
+            wcsncpy_s(result.snapshot, _countof(result.snapshot), snapshot, _TRUNCATE);
+            Addsorteddata(&searchtable.sorted, &result);
+        }
+
+        free(results);
+    } else if (iv.file) {
+        Addtolist(0, DRAW_HILITE, L"Skipped %s, not a snapshot index", path);
+    }
+
+    CloseIndexView(&iv);
+
+    return found;
+}
+
+// Searches every MODULE-*.idx next to the module, a leading ^ matches
+// only at the start of names
+static void SearchSnapshots(t_module *module, const wchar_t *basename)
+{
+    static wchar_t pattern[TEXTLEN];
+    char utf[TEXTLEN];
+    wchar_t path[MAXPATH];
+    WIN32_FIND_DATAW found;
+
+    if (Getstring(hwollymain, L"Search snapshot names", pattern, _countof(pattern), 0, 0, 0, 0, 0, 0) <= 0)
+        return;
+
+    int flags = pattern[0] == L'^' ? SEARCH_PREFIX : 0;
+    const wchar_t *text = pattern + (flags & SEARCH_PREFIX ? 1 : 0);
+
+    if (!*text)
+        return;
+
+    Unicodetoutf(text, wcslen(text), utf, _countof(utf));
+
+    InitSearchTable();
+    Deletesorteddatarange(&searchtable.sorted, 0, 0xFFFFFFFF);
+
+    swprintf(path, _countof(path), L"%s-*.idx", basename);
+
+    const wchar_t *slash = wcsrchr(basename, L'\\');
+    int dir_len = slash ? (int)(slash - basename) + 1 : 0;
+    int prefix_len = wcslen(basename) - dir_len + 1;
+
+    HANDLE find = FindFirstFileW(path, &found);
+    int indexes = 0;
+    int names = 0;
+
+    if (find != INVALID_HANDLE_VALUE) {
+        do {
+            wchar_t snapshot[MAXPATH];
+
+            swprintf(path, _countof(path), L"%.*s%s", dir_len, basename, found.cFileName);
+
+            // the part between MODULE- and .idx names the snapshot
+            wcscpy_s(snapshot, _countof(snapshot), found.cFileName + prefix_len);
+            wchar_t *ext = wcsrchr(snapshot, L'.');
+            if (ext)
+                *ext = L'\0';
+
+            // an index older than its snapshot no longer matches its rows
+            wchar_t csv[MAXPATH];
+            wcscpy_s(csv, _countof(csv), path);
+            wcscpy_s(wcsrchr(csv, L'.'), 5, L".csv");
+
+            if (!IndexIsCurrent(csv, path)) {
+                Addtolist(0, DRAW_HILITE, L"Skipped %s, older than its snapshot", path);
+                continue;
+            }
+
+            names += SearchIndexFile(path, snapshot, utf, flags, SEARCH_RESULTS - names);
+            indexes++;
+        } while (names < SEARCH_RESULTS && FindNextFileW(find, &found));
+
+        FindClose(find);
+    }
+
+    if (indexes == 0) {
+        Flash(L"No snapshot indexes found, save a snapshot first");
+        return;
+    }
+
+    if (searchtable.hw == NULL)
+        Createtablewindow(&searchtable, 0, searchtable.bar.nbar, hollyinst, NULL, L"Snapshot names");
+    else
+        Activatetablewindow(&searchtable);
+
+    Updatetable(&searchtable, 1);
+
+    if (names >= SEARCH_RESULTS)
+        Info(L"Showing the first %d names matching %s in %d snapshot indexes", names, pattern, indexes);
+    else
+        Info(L"%d names matching %s in %d snapshot indexes", names, pattern, indexes);
+}
+
+static INDEX_VIEW browseview;
+static wchar_t browsesnapshot[MAXPATH];    // Snapshot of the index in the browser
+
+static int BrowseSortfunc(const t_sorthdr *sh1, const t_sorthdr *sh2, const int sort)
+{
+    const search_t *s = &browseview.index;
+    ulong a = sh1->addr;
+    ulong b = sh2->addr;
+    int ret = 0;
+
+    // records are stored in address order, so their number sorts by address
+    switch (sort) {
+        case 1: ret = (int)s->records[a].type - (int)s->records[b].type; break;
+        case 2: ret = _stricmp(SEARCH_STR(s, a), SEARCH_STR(s, b)); break;
+    }
+
+    if (ret == 0)
+        ret = a < b ? -1 : a > b;
+
+    return ret;
+}
+
+static int BrowseDrawfunc(wchar_t *s, uchar *mask, int *select, t_table *pt, t_sorthdr *ps, int column, void *cache)
+{
+    const search_t *index = &browseview.index;
+    t_module *module = Findmainmodule();
+
+    if (column < 0 || ps->addr >= index->count)
+        return 0;
+
+    const search_record_t *record = &index->records[ps->addr];
+    const char *text;
+
+    switch (column) {
+        case 0:
+            return swprintf(s, TEXTLEN, L"%08X", (module ? module->base : 0) + record->address);
+        case 1:
+            if (!NameTypeBit(record->type))
+                return 0;
+            text = NameTypeString(record->type);
+            break;
+        case 2:
+            text = SEARCH_STR(index, ps->addr);
+            break;
+        default:
+            return 0;
+    }
+
+    return Utftounicode(text, strlen(text), s, TEXTLEN);
+}
+
+static long BrowseTabfunc(t_table *pt, HWND hw, UINT msg, WPARAM wp, LPARAM lp)
+{
+    if (msg == WM_USER_DBLCLK) {
+        const t_sorthdr *row = Getsortedbyselection(&pt->sorted, pt->sorted.selected);
+        t_module *module = Findmainmodule();
+
+        if (row && module && row->addr < browseview.index.count)
+            Setcpu(0, module->base + browseview.index.records[row->addr].address, 0, 0, 0, CPU_ASMHIST | CPU_ASMCENTER | CPU_ASMFOCUS);
+
+        return 1;
+    }
+
+    return 0;
+}
+
+// Imports the selected row, the rows of its type or every row
+static int BrowseMenufunc(t_table *pt, wchar_t *name, ulong index, int mode)
+{
+    const t_sorthdr *row = Getsortedbyselection(&pt->sorted, pt->sorted.selected);
+    t_module *module = Findmainmodule();
+    const search_t *s = &browseview.index;
+
+    if (!row || !module || row->addr >= s->count)
+        return MENU_GRAYED;
+
+    if (mode == MENU_VERIFY)
+        return MENU_NORMAL;
+
+    if (mode != MENU_EXECUTE)
+        return MENU_ABSENT;
+
+    identity_t saved;
+    char utf[MAXPATH];
+
+    Unicodetoutf(browsesnapshot, wcslen(browsesnapshot), utf, _countof(utf));
+    backup_read_identity(utf, &saved);
+
+    if (!ConfirmIdentity(module, &saved, browsesnapshot)) {
+        Flash(L"Import cancelled, module identity does not match");
+        return MENU_NOREDRAW;
+    }
+
+    uint32_t type = s->records[row->addr].type;
+    uint32_t first = index == 0 ? row->addr : 0;
+    uint32_t last = index == 0 ? row->addr + 1 : s->count;
+    int imported = 0;
+
+    for (uint32_t i = first; i < last; i++) {
+        const search_record_t *record = &s->records[i];
+
+        // the mangled analysis label is not a type OllyDbg takes
+        if (!NameTypeBit(record->type) || record->type == NM_ANLABEL + 1)
+            continue;
+        if (index == 1 && record->type != type)
+            continue;
+        if (record->address >= module->size)
+            continue;
+
+        engine_insert(module->base + record->address, record->type, SEARCH_STR(s, i));
+        imported++;
+    }
+
+    if (imported)
+        engine_merge();
+
+    Info(L"Imported %d names into %s", imported, module->modname);
+    return MENU_REDRAW;
+}
+
+static t_menu browsemenu[] = {
+    { L"Import Name", L"Add the selected name to the module", K_NONE, BrowseMenufunc, NULL, { 0 } },
+    { L"Import All Names of This Type", L"Add every name of the selected type to the module", K_NONE, BrowseMenufunc, NULL, { 1 } },
+    { L"Import All Names", L"Add every name of the snapshot to the module", K_NONE, BrowseMenufunc, NULL, { 2 } },
+    { NULL, NULL, K_NONE, NULL, NULL, { 0 } }
+};
+
+static void InitBrowseTable(void)
+{
+    if (browsetable.sorted.itemsize)
+        return;
+
+    wcscpy_s(browsetable.name, _countof(browsetable.name), L"Snapshot browser");
+    browsetable.mode = TABLE_SAVEPOS | TABLE_SAVECOL;
+    browsetable.bar.visible = 1;
+    browsetable.bar.nbar = 3;
+
+    browsetable.bar.name[0] = L"Address";
+    browsetable.bar.expl[0] = L"Address of the name in the loaded module";
+    browsetable.bar.mode[0] = BAR_SORT;
+    browsetable.bar.defdx[0] = 9;
+
+    browsetable.bar.name[1] = L"Type";
+    browsetable.bar.expl[1] = L"Type of the name";
+    browsetable.bar.mode[1] = BAR_SORT;
+    browsetable.bar.defdx[1] = 18;
+
+    browsetable.bar.name[2] = L"Name";
+    browsetable.bar.expl[2] = L"Label or comment";
+    browsetable.bar.mode[2] = BAR_SORT;
+    browsetable.bar.defdx[2] = 64;
+
+    browsetable.tabfunc = BrowseTabfunc;
+    browsetable.drawfunc = BrowseDrawfunc;
+    browsetable.menu = browsemenu;
+
+    // rows hold only the record number, the rest is read from the mapping
+    // when a row is drawn
+    Createsorteddata(&browsetable.sorted, sizeof(t_sorthdr_nosize), 1024, BrowseSortfunc, NULL, SDM_NOSIZE);
+}
+
+static void CloseSnapshotBrowser(void)
+{
+    if (browsetable.sorted.itemsize)
+        Deletesorteddatarange(&browsetable.sorted, 0, 0xFFFFFFFF);
+
+    CloseIndexView(&browseview);
+}
+
+// Whether the snapshot has an index that is not older than it
+static bool IndexIsCurrent(const wchar_t *filename, const wchar_t *path)
+{
+    WIN32_FILE_ATTRIBUTE_DATA csv, idx;
+
+    return GetFileAttributesExW(filename, GetFileExInfoStandard, &csv) &&
+           GetFileAttributesExW(path, GetFileExInfoStandard, &idx) &&
+           CompareFileTime(&idx.ftLastWriteTime, &csv.ftLastWriteTime) >= 0;
+}
+
+// Loads a snapshot and writes its index, off the main thread
+static DWORD WINAPI IndexWorker(LPVOID param)
+{
+    INDEX_JOB *job = param;
+    rva_t *rvas = backup_load(job->csv, NULL, job->message);
+
+    job->ok = false;
+
+    if (rvas) {
+        names_t names = { 0 };
+        SnapshotNames(rvas, &names);
+        LIST_FREE(rvas);
+
+        job->ok = search_write(job->idx, &names, job->message);
+        names_free(&names);
+    }
+
+    return 0;
+}
+
+// Opens the browser on the snapshot once its index is built
+static void ReapIndex(DWORD timeout, bool browse)
+{
+    wchar_t unicode[TEXTLEN];
+
+    if (!indexjob.worker || WaitForSingleObject(indexjob.worker, timeout) != WAIT_OBJECT_0)
+        return;
+
+    CloseHandle(indexjob.worker);
+    indexjob.worker = NULL;
+
+    if (!browse)
+        return;
+
+    if (!indexjob.ok) {
+        Utftounicode(indexjob.message, strlen(indexjob.message), unicode, _countof(unicode));
+        Flash(unicode);
+        return;
+    }
+
+    BrowseSnapshot(indexjob.snapshot);
+}
+
+// Lists a snapshot through its index without loading it into the module. A
+// snapshot without an up to date index gets one built in the background
+// first, and is listed when it is ready.
+static void BrowseSnapshot(const wchar_t *filename)
+{
+    wchar_t path[MAXPATH];
+
+    wcscpy_s(path, _countof(path), filename);
+
+    wchar_t *ext = wcsrchr(path, L'.');
+    if (ext && _wcsicmp(ext, L".csv") == 0) {
+        wcscpy_s(ext, _countof(path) - (ext - path), L".idx");
+
+        WIN32_FILE_ATTRIBUTE_DATA attr;
+
+        if (!GetFileAttributesExW(filename, GetFileExInfoStandard, &attr)) {
+            Flash(L"Snapshot %s not found", filename);
+            return;
+        }
+
+        if (!IndexIsCurrent(filename, path)) {
+            if (indexjob.worker) {
+                Flash(L"Another snapshot is being indexed");
+                return;
+            }
+
+            // the browser may have the old index mapped
+            CloseSnapshotBrowser();
+
+            wcscpy_s(indexjob.snapshot, _countof(indexjob.snapshot), filename);
+            Unicodetoutf(filename, wcslen(filename), indexjob.csv, _countof(indexjob.csv));
+            Unicodetoutf(path, wcslen(path), indexjob.idx, _countof(indexjob.idx));
+
+            indexjob.worker = CreateThread(NULL, 0, IndexWorker, &indexjob, 0, NULL);
+
+            if (indexjob.worker) {
+                SetThreadPriority(indexjob.worker, THREAD_PRIORITY_LOWEST);
+                Info(L"Indexing %s, it is listed when done", filename);
+                return;
+            }
+
+            IndexWorker(&indexjob);
+
+            if (!indexjob.ok) {
+                wchar_t unicode[TEXTLEN];
+                Utftounicode(indexjob.message, strlen(indexjob.message), unicode, _countof(unicode));
+                Flash(unicode);
+                return;
+            }
+        }
+
+        wcscpy_s(browsesnapshot, _countof(browsesnapshot), filename);
+    } else {
+        // an index opened directly belongs to the snapshot next to it
+        wcscpy_s(browsesnapshot, _countof(browsesnapshot), filename);
+        ext = wcsrchr(browsesnapshot, L'.');
+        if (ext)
+            wcscpy_s(ext, _countof(browsesnapshot) - (ext - browsesnapshot), L".csv");
+    }
+
+    InitBrowseTable();
+    CloseSnapshotBrowser();
+
+    if (!OpenIndexView(path, &browseview)) {
+        CloseIndexView(&browseview);
+        Flash(L"%s is not a snapshot index", path);
+        return;
+    }
+
+    // OllyDbg tables need a row per record, only its number is kept and the
+    // rest is read from the index when it is drawn
+    uint32_t count = browseview.index.count;
+    t_sorthdr_nosize *rows = malloc((count + 1) * sizeof(t_sorthdr_nosize));
+
+    if (!rows) {
+        CloseIndexView(&browseview);
+        Flash(L"Out of memory");
+        return;
+    }
+
+    for (uint32_t i = 0; i < count; i++)
+        rows[i].addr = i;
+
+    Replacesorteddatarange(&browsetable.sorted, rows, count, 0, 0xFFFFFFFF);
+    free(rows);
+
+    if (browsetable.hw == NULL)
+        Createtablewindow(&browsetable, 0, browsetable.bar.nbar, hollyinst, NULL, L"Snapshot browser");
+    else
+        Activatetablewindow(&browsetable);
+
+    Updatetable(&browsetable, 1);
+
+    Info(L"%u names in %s", count, path);
+}
+
+typedef struct HISTORY_ROW {
+    t_sorthdr hdr;              // addr is the row number in the catalog
+    catalog_t entry;
+} HISTORY_ROW;
+
+static char historyidentity[64];
+
+static int HistorySortfunc(const t_sorthdr *sh1, const t_sorthdr *sh2, const int sort)
+{
+    const catalog_t *a = &((const HISTORY_ROW *)sh1)->entry;
+    const catalog_t *b = &((const HISTORY_ROW *)sh2)->entry;
+    int ret = 0;
+
+    switch (sort) {
+        case 0: ret = strcmp(a->saved, b->saved); break;
+        case 1: ret = strcmp(a->profile, b->profile); break;
+        case 2: ret = a->names - b->names; break;
+        case 4: ret = strcmp(a->identity, b->identity); break;
+        case 5: ret = _stricmp(a->file, b->file); break;
+    }
+
+    if (ret == 0)
+        ret = sh1->addr < sh2->addr ? -1 : sh1->addr > sh2->addr;
+
+    return ret;
+}
+
+static int HistoryDrawfunc(wchar_t *s, uchar *mask, int *select, t_table *pt, t_sorthdr *ps, int column, void *cache)
+{
+    const catalog_t *entry = &((const HISTORY_ROW *)ps)->entry;
+    const char *text;
+
+    if (column < 0)
+        return 0;
+
+    // snapshots of another build of the module are grayed
+    if (entry->identity[0] && historyidentity[0] && strcmp(entry->identity, historyidentity) != 0)
+        *select |= DRAW_GRAY;
+
+    switch (column) {
+        case 0: text = entry->saved; break;
+        case 1: text = entry->profile; break;
+        case 2: return swprintf(s, TEXTLEN, L"%d", entry->names);
+        case 3: text = entry->counts; break;
+        case 4: text = entry->identity; break;
+        case 5: text = entry->file; break;
+        default: return 0;
+    }
+
+    return Utftounicode(text, strlen(text), s, TEXTLEN);
+}
+
+static long HistoryTabfunc(t_table *pt, HWND hw, UINT msg, WPARAM wp, LPARAM lp)
+{
+    if (msg == WM_USER_DBLCLK) {
+        const HISTORY_ROW *row = Getsortedbyselection(&pt->sorted, pt->sorted.selected);
+        t_module *module = Findmainmodule();
+
+        if (row && module) {
+            wchar_t path[MAXPATH];
+            wchar_t file[MAXPATH];
+
+            wcscpy_s(path, _countof(path), module->path);
+            wchar_t *slash = wcsrchr(path, L'\\');
+            if (slash)
+                slash[1] = L'\0';
+
+            Utftounicode(row->entry.file, strlen(row->entry.file), file, _countof(file));
+            wcscat_s(path, _countof(path), file);
+            BrowseSnapshot(path);
+        }
+
+        return 1;
+    }
+
+    return 0;
+}
+
+static void InitHistoryTable(void)
+{
+    static wchar_t *names[] = { L"Saved", L"Profile", L"Names", L"Counts", L"Identity", L"File" };
+    static wchar_t *expl[] = {
+        L"Local time the snapshot was saved",
+        L"Name types in the snapshot",
+        L"Number of names",
+        L"Number of names of each type",
+        L"Size, timestamp and CRC of the module it was saved from",
+        L"Snapshot file, double-click to browse it"
+    };
+    static const int widths[] = { 20, 11, 8, 40, 28, 40 };
+
+    if (historytable.sorted.itemsize)
+        return;
+
+    wcscpy_s(historytable.name, _countof(historytable.name), L"Snapshot history");
+    historytable.mode = TABLE_SAVEPOS | TABLE_SAVECOL;
+    historytable.bar.visible = 1;
+    historytable.bar.nbar = _countof(names);
+
+    for (int i = 0; i < historytable.bar.nbar; i++) {
+        historytable.bar.name[i] = names[i];
+        historytable.bar.expl[i] = expl[i];
+        historytable.bar.mode[i] = i == 3 ? BAR_FLAT : BAR_SORT;
+        historytable.bar.defdx[i] = widths[i];
+    }
+
+    historytable.tabfunc = HistoryTabfunc;
+    historytable.drawfunc = HistoryDrawfunc;
+
+    Createsorteddata(&historytable.sorted, sizeof(HISTORY_ROW), 256, HistorySortfunc, NULL, 0);
+}
+
+// Lists the snapshots of the module from its catalog alone
+static void ShowHistory(t_module *module)
+{
+    char path[MAXPATH];
+    char message[1024];
+    wchar_t unicode[TEXTLEN];
+    identity_t identity;
+
+    ModuleFilePath(module, L"-catalog.csv", path, sizeof path);
+
+    catalog_t *entries = catalog_load(path, message);
+
+    if (!entries) {
+        Utftounicode(message, strlen(message), unicode, _countof(unicode));
+        Flash(unicode);
+        return;
+    }
+
+    historyidentity[0] = '\0';
+    if (backup_identity(module->path, &identity))
+        backup_identity_string(&identity, historyidentity, sizeof historyidentity);
+
+    InitHistoryTable();
+    Deletesorteddatarange(&historytable.sorted, 0, 0xFFFFFFFF);
+
+    int count = 0;
+
+    LIST_FOREACH (entries, catalog_t, entry) {
+        HISTORY_ROW row = { { count++, 1, 0 } };
+        row.entry = *entry;
+        row.entry.next = NULL;
+        Addsorteddata(&historytable.sorted, &row);
+    }
+
+    LIST_FREE(entries);
+
+    if (historytable.hw == NULL)
+        Createtablewindow(&historytable, 0, historytable.bar.nbar, hollyinst, NULL, L"Snapshot history");
+    else
+        Activatetablewindow(&historytable);
+
+    Updatetable(&historytable, 1);
+
+    Info(L"%d snapshots of %s", count, module->modname);
+}
+
+typedef struct snapshot_t {
+    ulong base;
+    unsigned int hash;
+    DWORD tick;
+    struct snapshot_t *next;
+} snapshot_t;
+
+static snapshot_t *snapshots = NULL;
+
+static int NameTypeList(const NAME_TYPE **Names, int *list)
+{
+    int n = 0;
+
+    for (int i = 0; Names[i]; i++) {
+        if (Names[i]->type != NM_ANLABEL + 1)
+            list[n++] = Names[i]->type;
+    }
+
+    return n;
+}
+
+static unsigned int HashNames(t_module *module, const NAME_TYPE **Names)
+{
+    int list[_countof(RawTypeLookup)];
+    int n = NameTypeList(Names, list);
+
+    unsigned int hash = BACKUP_HASH_INIT;
+    wchar_t name[TEXTLEN];
+    ulong addr;
+    int type;
+    int len;
+
+    // walks only the names that exist, unlike the per-address scan of CollectNames
+    Startnextnamelist(module->base, module->base + module->size, (int *)list, n);
+
+    while ((len = FindnextnamelistW(&addr, &type, name, _countof(name))) > 0) {
+        hash = backup_hash(hash, &addr, sizeof addr);
+        hash = backup_hash(hash, &type, sizeof type);
+        hash = backup_hash(hash, name, len * sizeof(wchar_t));
+    }
+
+    return hash;
+}
+
+static void AutoSnapshot(t_module *module, bool force)
+{
+    if (module == NULL)
+        return;
+
+    snapshot_t *state = NULL;
+
+    LIST_FOREACH (snapshots, snapshot_t, el) {
+        if (el->base == module->base) {
+            state = el;
+            break;
+        }
+    }
+
+    DWORD now = GetTickCount();
+
+    if (state && !force) {
+        // saveudd stays clear until the user touches the module, the common case
+        if (!module->saveudd || now - state->tick < AUTOSAVE_INTERVAL)
+            return;
+    }
+
+    unsigned int hash = HashNames(module, UserNameTypes);
+
+    if (state ? state->hash == hash : hash == BACKUP_HASH_INIT) {
+        if (state)
+            state->tick = now;
+        return;
+    }
+
+    wchar_t filename[MAXPATH];
+    wcscpy_s(filename, _countof(filename), module->path);
+
+    wchar_t *last_stop = wcsrchr(filename, L'.');
+    if (!last_stop)
+        return;
+
+    *last_stop = L'\0';
+    wcscat_s(filename, _countof(filename), L"-user-auto.csv");
+
+    char message[1024];
+    if (!ExportToFile(module, filename, UserNameTypes, message)) {
+        wchar_t unicode[TEXTLEN];
+        Utftounicode(message, strlen(message), unicode, _countof(unicode));
+        Addtolist(0, DRAW_HILITE, L"%s", unicode);
+        return;
+    }
+
+    if (!state) {
+        state = LIST_ALLOC(snapshot_t);
+        state->base = module->base;
+        LIST_INSERT(snapshots, state);
+    }
+
+    state->hash = hash;
+    state->tick = now;
+
+    Addtolist(0, DRAW_NORMAL, L"Automatic snapshot of %s saved to %s", module->modname, filename);
+}
+
+static void ForgetSnapshot(t_module *module)
+{
+    if (module == NULL) {
+        LIST_FREE(snapshots);
+        return;
+    }
+
+    LIST_FOREACH (snapshots, snapshot_t, el) {
+        if (el->base == module->base) {
+            LIST_REMOVE(snapshots, el);
+            free(el);
+            break;
+        }
+    }
+}
+
+static journal_t journal;
+static ulong journal_base = 0;
+static bool journal_ok = false;
+
+static void EnumerateNames(t_module *module, const NAME_TYPE **Names, names_t *names)
+{
+    int list[_countof(RawTypeLookup)];
+    int n = NameTypeList(Names, list);
+
+    EnumerateNameList(module, list, n, names);
+}
+
+static void EnumerateNameList(t_module *module, const int *list, int n, names_t *names)
+{
+    EnumerateNameRange(module, module->base, module->base + module->size, list, n, names);
+}
+
+// Only walks the names OllyDbg has in addr0..addr1, not every address.
+// Analysis labels are demangled like FindCollectName does for a save, so
+// they compare equal to the ANALYSIS_LABEL rows of a snapshot.
+static void EnumerateNameRange(t_module *module, ulong addr0, ulong addr1, const int *list, int n, names_t *names)
+{
+    wchar_t name[TEXTLEN];
+    wchar_t demangled[TEXTLEN];
+    char utf[TEXTLEN * 3];
+    ulong addr;
+    int type;
+    int len;
+
+    STATS_ENTER(STATS_ENUMERATE);
+
+    Startnextnamelist(addr0, addr1, (int *)list, n);
+
+    while ((len = FindnextnamelistW(&addr, &type, name, _countof(name))) > 0) {
+        STATS_ADD(STATS_CALLS, 1);
+
+        if (type == NM_ANLABEL) {
+            STATS_ENTER(STATS_DEMANGLE);
+            bool undecorated = DemanglenameW(name, demangled, 0);
+            STATS_LEAVE(STATS_DEMANGLE);
+
+            if (undecorated) {
+                wcscpy_s(name, _countof(name), demangled);
+                len = wcslen(name);
+            }
+        }
+
+        STATS_ENTER(STATS_UTF);
+        Unicodetoutf(name, len, utf, _countof(utf));
+        STATS_LEAVE(STATS_UTF);
+        names_add(names, addr - module->base, type, utf);
+    }
+
+    names_sort(names);
+
+    STATS_LEAVE(STATS_ENUMERATE);
+}
+
+static void OpenJournal(t_module *module)
+{
+    wchar_t path[MAXPATH];
+    char stem[MAXPATH];
+    char message[1024];
+    wchar_t unicode[TEXTLEN];
+
+    CloseJournal();
+    journal_base = module->base;
+
+    wcscpy_s(path, _countof(path), module->path);
+
+    wchar_t *last_stop = wcsrchr(path, L'.');
+    if (!last_stop)
+        return;
+
+    *last_stop = L'\0';
+    wcscat_s(path, _countof(path), L"-user-journal");
+    Unicodetoutf(path, wcslen(path), stem, _countof(stem));
+
+    identity_t identity;
+    if (!backup_identity(module->path, &identity)) {
+        Addtolist(0, DRAW_HILITE, L"Failed to read %s, journaling stopped", module->path);
+        return;
+    }
+
+    names_t names = { 0 };
+
+    // a journal left behind means the last session did not end cleanly
+    int replay = journal_replay(stem, ParseNameType, &identity, &names, message);
+
+    if (replay == JOURNAL_STALE) {
+        Utftounicode(message, strlen(message), unicode, _countof(unicode));
+        Addtolist(0, DRAW_HILITE, L"%s", unicode);
+    } else if (replay == JOURNAL_REPLAYED) {
+        for (int i = 0; i < names.count; i++) {
+            ulong addr = module->base + names.items[i].address;
+            const char *name = NAMES_STR(&names, i);
+
+            if (name[0])
+                engine_insert(addr, names.items[i].type, name);
+            else
+                Deletedatarange(addr, addr + 1, names.items[i].type, DT_NONE, DT_NONE);
+        }
+
+        engine_merge();
+
+        Utftounicode(message, strlen(message), unicode, _countof(unicode));
+        Addtolist(0, DRAW_HILITE, L"%s", unicode);
+    }
+
+    names_free(&names);
+
+    EnumerateNames(module, UserNameTypes, &names);
+    journal_ok = journal_open(&journal, stem, NameTypeString, &identity, &names, message);
+
+    Utftounicode(message, strlen(message), unicode, _countof(unicode));
+    Addtolist(0, journal_ok ? DRAW_NORMAL : DRAW_HILITE, L"%s", unicode);
+}
+
+static void UpdateJournal(t_module *module)
+{
+    if (module == NULL)
+        return;
+
+    if (module->base != journal_base) {
+        OpenJournal(module);
+        return;
+    }
+
+    if (!journal_ok || !module->saveudd)
+        return;
+
+    names_t live = { 0 };
+    EnumerateNames(module, UserNameTypes, &live);
+
+    if (journal_update(&journal, &live) < 0) {
+        Addtolist(0, DRAW_HILITE, L"Failed to append to the journal, journaling stopped");
+        journal_close(&journal);
+        journal_ok = false;
+    }
+}
+
+static void CloseJournal(void)
+{
+    if (journal_ok)
+        journal_close(&journal);
+
+    journal_ok = false;
+    journal_base = 0;
+}
+
+static void ModuleIdentity(t_module *pmod, char *buf, size_t len)
+{
+    identity_t identity;
+
+    if (!backup_identity(pmod->path, &identity)) {
+        buf[0] = '\0';
+        return;
+    }
+
+    backup_identity_string(&identity, buf, len);
+}
+
+// MODULE-analysis.bin in the plugin data directory, modules may live in
+// system directories that are not ours to write to
+static void AnalysisPath(t_module *pmod, char *dst, size_t size)
+{
+    wchar_t path[MAXPATH];
+
+    swprintf(path, _countof(path), L"%s\\%s-analysis.bin", plugindir, pmod->modname);
+    Unicodetoutf(path, wcslen(path), dst, size);
+}
+
+// Writes the procedures, local jumps and loop and argument brackets OllyDbg
+// has for the module to MODULE-analysis.bin, keyed by the module build.
+// A cache that already holds the same is left alone.
+static bool SaveAnalysis(t_module *pmod, bool verbose)
+{
+    wchar_t unicode[TEXTLEN];
+    char path[MAXPATH];
+    char message[1024];
+    analysis_t a = { { 0 } };
+    ulong end = pmod->base + pmod->size;
+    int nprocs = 0;
+    int njumps = 0;
+
+    ModuleIdentity(pmod, a.identity, sizeof a.identity);
+
+    if (!a.identity[0]) {
+        if (verbose)
+            Flash(L"Can't identify %s, analysis not cached", pmod->modname);
+        return false;
+    }
+
+    int first = Findsortedindexrange((t_sorted *)&procdata, pmod->base, end);
+    t_procdata *procs = first >= 0 ? malloc((procdata.n - first) * sizeof(t_procdata)) : NULL;
+
+    for (int i = first; procs && i < procdata.n; i++) {
+        t_procdata *pd = Getsortedbyindex((t_sorted *)&procdata, i);
+        if (!pd || pd->addr >= end)
+            break;
+        procs[nprocs] = *pd;
+        procs[nprocs++].addr -= pmod->base;
+    }
+
+    // jumps out of the module point into other builds and are left out
+    analysis_jump_t *jumps = malloc((pmod->jumps.njmp + 1) * sizeof(analysis_jump_t));
+
+    for (int i = 0; jumps && i < pmod->jumps.njmp; i++) {
+        const t_jmp *jmp = &pmod->jumps.jmpdata[i];
+        if (jmp->dest - pmod->base < pmod->size) {
+            jumps[njumps].from = jmp->from - pmod->base;
+            jumps[njumps].dest = jmp->dest - pmod->base;
+            jumps[njumps++].type = jmp->type;
+        }
+    }
+
+    ulong loopsize = 0;
+    ulong argsize = 0;
+    void *loops = pmod->loopnest.n ? Nesteddatatoudd(&pmod->loopnest, pmod->base, &loopsize) : NULL;
+    void *args = pmod->argnest.n ? Nesteddatatoudd(&pmod->argnest, pmod->base, &argsize) : NULL;
+
+    a.data[ANALYSIS_PROCS] = procs;
+    a.size[ANALYSIS_PROCS] = nprocs * sizeof(t_procdata);
+    a.itemsize[ANALYSIS_PROCS] = sizeof(t_procdata);
+    a.data[ANALYSIS_JUMPS] = jumps;
+    a.size[ANALYSIS_JUMPS] = njumps * sizeof(analysis_jump_t);
+    a.itemsize[ANALYSIS_JUMPS] = sizeof(analysis_jump_t);
+    a.data[ANALYSIS_LOOPS] = loops;
+    a.size[ANALYSIS_LOOPS] = loops ? loopsize : 0;
+    a.data[ANALYSIS_ARGS] = args;
+    a.size[ANALYSIS_ARGS] = args ? argsize : 0;
+
+    AnalysisPath(pmod, path, sizeof path);
+
+    analysis_t cached;
+    bool same = analysis_load(path, &cached, message) && analysis_equal(&a, &cached);
+    bool ok = same || analysis_save(path, &a, message);
+
+    if (same)
+        analysis_free(&cached);
+
+    free(procs);
+    free(jumps);
+    if (loops)
+        Memfree(loops);
+    if (args)
+        Memfree(args);
+
+    if (!ok) {
+        Utftounicode(message, strlen(message), unicode, _countof(unicode));
+        if (verbose)
+            Flash(unicode);
+        else
+            Addtolist(0, DRAW_HILITE, L"%s", unicode);
+        return false;
+    }
+
+    if (verbose && same)
+        Info(L"The analysis cache of %s is up to date", pmod->modname);
+    else if (verbose)
+        Info(L"Cached %d procedures and %d jumps of %s", nprocs, njumps, pmod->modname);
+
+    return true;
+}
+
+// Adds the cached analysis of the same build where OllyDbg has none: the
+// procedures and jumps it does not know, and the brackets if it has none
+static bool RestoreAnalysis(t_module *pmod, bool verbose)
+{
+    wchar_t unicode[TEXTLEN];
+    char path[MAXPATH];
+    char message[1024];
+    char identity[64];
+    analysis_t a;
+    int nprocs = 0;
+    int njumps = 0;
+    int brackets = 0;
+
+    AnalysisPath(pmod, path, sizeof path);
+
+    if (!analysis_load(path, &a, message)) {
+        if (verbose) {
+            Utftounicode(message, strlen(message), unicode, _countof(unicode));
+            Flash(unicode);
+        }
+        return false;
+    }
+
+    ModuleIdentity(pmod, identity, sizeof identity);
+
+    if (!identity[0] || strcmp(identity, a.identity) != 0 ||
+        a.itemsize[ANALYSIS_PROCS] != sizeof(t_procdata) ||
+        a.itemsize[ANALYSIS_JUMPS] != sizeof(analysis_jump_t)) {
+        analysis_free(&a);
+        if (verbose)
+            Flash(L"The analysis cache of %s is from a different build", pmod->modname);
+        return false;
+    }
+
+    t_procdata *procs = a.data[ANALYSIS_PROCS];
+
+    for (unsigned int i = 0; i < a.size[ANALYSIS_PROCS] / sizeof(t_procdata); i++) {
+        t_procdata pd = procs[i];
+
+        if (pd.addr >= pmod->size)
+            continue;
+
+        pd.addr += pmod->base;
+
+        if (!Findsorteddata((t_sorted *)&procdata, pd.addr, 0) && Addsorteddata((t_sorted *)&procdata, &pd))
+            nprocs++;
+    }
+
+    const analysis_jump_t *jumps = a.data[ANALYSIS_JUMPS];
+
+    for (unsigned int i = 0; i < a.size[ANALYSIS_JUMPS] / sizeof(analysis_jump_t); i++) {
+        if (jumps[i].from >= pmod->size || jumps[i].dest >= pmod->size)
+            continue;
+
+        ulong from = pmod->base + jumps[i].from;
+
+        // one sort for the whole batch
+        if (!Findjumpfrom(from)) {
+            Addjump(&pmod->jumps, from, pmod->base + jumps[i].dest, jumps[i].type | JT_NOSORT);
+            njumps++;
+        }
+    }
+
+    if (njumps)
+        Sortjumpdata(&pmod->jumps);
+
+    if (a.size[ANALYSIS_LOOPS] && pmod->loopnest.n == 0) {
+        Uddtonesteddata(&pmod->loopnest, a.data[ANALYSIS_LOOPS], pmod->base, a.size[ANALYSIS_LOOPS]);
+        brackets += pmod->loopnest.n;
+    }
+
+    if (a.size[ANALYSIS_ARGS] && pmod->argnest.n == 0) {
+        Uddtonesteddata(&pmod->argnest, a.data[ANALYSIS_ARGS], pmod->base, a.size[ANALYSIS_ARGS]);
+        brackets += pmod->argnest.n;
+    }
+
+    analysis_free(&a);
+
+    if (verbose || nprocs || njumps || brackets) {
+        Addtolist(pmod->base, DRAW_NORMAL, L"Restored %d procedures, %d jumps and %d brackets of %s from the analysis cache",
+                  nprocs, njumps, brackets, pmod->modname);
+    }
+
+    return true;
+}
+
+static int DataRecordTypes[] = { DT_ARG, DT_NARG, DT_SWITCH, DT_CASE, DT_MNEMO };
+
+// Switch and case descriptors point at each other by address, moves those
+// by delta so the records can be kept as RVAs
+static void RebaseDataRecord(int type, void *data, int size, ulong delta)
+{
+    if (type == DT_SWITCH && size >= (int)offsetof(dt_switch, exitaddr)) {
+        dt_switch *sw = data;
+        int n = (size - (int)offsetof(dt_switch, exitaddr)) / (int)sizeof(ulong);
+
+        if (n > sw->nexit)
+            n = sw->nexit;
+
+        for (int i = 0; i < n; i++)
+            sw->exitaddr[i] += delta;
+    } else if (type == DT_CASE && size >= (int)sizeof(ulong)) {
+        ((dt_case *)data)->swbase += delta;
+    }
+}
+
+// Writes the argument, switch and mnemonic decorations of the module to
+// MODULE-data.bin in one pass over OllyDbg's data table
+static bool SaveDataRecords(t_module *module)
+{
+    wchar_t unicode[TEXTLEN];
+    char path[MAXPATH];
+    char message[1024];
+    uchar data[4096];
+    records_t records = { { 0 } };
+    ulong address;
+    int type;
+    int size;
+    int skipped = 0;
+
+    ModuleIdentity(module, records.identity, sizeof records.identity);
+
+    Startnextdatalist(module->base, module->base + module->size, DataRecordTypes, _countof(DataRecordTypes));
+
+    while ((size = Findnextdatalist(&address, &type, data, sizeof data)) >= 0) {
+        if (size > (int)sizeof data) {
+            skipped++;
+            continue;
+        }
+
+        RebaseDataRecord(type, data, size, -module->base);
+
+        if (!records_add(&records, address - module->base, type, data, size))
+            skipped++;
+    }
+
+    ModuleFilePath(module, L"-data.bin", path, sizeof path);
+
+    bool ok = records_save(path, &records, message);
+    records_free(&records);
+
+    Utftounicode(message, strlen(message), unicode, _countof(unicode));
+
+    if (!ok) {
+        Flash(unicode);
+        return false;
+    }
+
+    if (skipped)
+        Addtolist(0, DRAW_HILITE, L"%d data records of %s were too large to save", skipped, module->modname);
+
+    Info(unicode);
+    return true;
+}
+
+// Queues every record of MODULE-data.bin and merges them into OllyDbg's data
+// table at once
+static bool LoadDataRecords(t_module *module)
+{
+    wchar_t unicode[TEXTLEN];
+    char path[MAXPATH];
+    char message[1024];
+    char identity[64];
+    records_t records;
+    int loaded = 0;
+
+    ModuleFilePath(module, L"-data.bin", path, sizeof path);
+
+    if (!records_load(path, &records, message)) {
+        Utftounicode(message, strlen(message), unicode, _countof(unicode));
+        Flash(unicode);
+        return false;
+    }
+
+    ModuleIdentity(module, identity, sizeof identity);
+
+    if (records.identity[0] && identity[0] && strcmp(identity, records.identity) != 0) {
+        if (Condyesno(NULL, PLUGINNAME, L"The data records of %s were saved from a different build.\n\nApply them anyway?", module->modname) != IDYES) {
+            records_free(&records);
+            Flash(L"Load cancelled, module identity does not match");
+            return false;
+        }
+    }
+
+    for (int i = 0; i < records.count; i++) {
+        const record_t *r = &records.items[i];
+        uchar *data = RECORDS_DATA(&records, i);
+
+        if (r->address >= module->size)
+            continue;
+
+        RebaseDataRecord(r->type, data, r->size, module->base);
+
+        if (Quickinsertdata(module->base + r->address, r->type, data, r->size) == 0)
+            loaded++;
+    }
+
+    if (loaded)
+        Mergequickdata();
+
+    Info(L"Loaded %d of %d data records into %s", loaded, records.count, module->modname);
+    records_free(&records);
+    return true;
+}
+
+#define BREAK_INT3      1           // Record types of MODULE-breakpoints.bin
+#define BREAK_MEM       2
+#define BREAK_HARD      3
+#define BREAK_PATCH     4
+
+#define PATCH_GAP       64          // Patches this close are written together
+#define PATCH_RUN       65536       // Most bytes written at once
+
+// Common part of the breakpoint records, followed by the condition, the
+// expression and its type as null terminated wide strings
+typedef struct breakpoint_t {
+    ulong size;
+    ulong type;
+    ulong limit;
+    ulong actions;
+    long fnindex;
+} breakpoint_t;
+
+static bool AddBreakpoint(records_t *records, ulong rva, int type, const breakpoint_t *bp, ulong addr, int nmbase)
+{
+    uchar data[sizeof(breakpoint_t) + 3 * TEXTLEN * sizeof(wchar_t)];
+    size_t size = sizeof(breakpoint_t);
+
+    memcpy(data, bp, sizeof(breakpoint_t));
+
+    for (int i = 0; i < 3; i++) {
+        wchar_t *text = (wchar_t *)(data + size);
+        int len = FindnameW(addr, nmbase + i, text, TEXTLEN);
+
+        if (len < 0)
+            len = 0;
+
+        text[len] = L'\0';
+        size += (len + 1) * sizeof(wchar_t);
+    }
+
+    return records_add(records, rva, type, data, size);
+}
+
+// Points text at the three strings after a breakpoint record, empty ones
+// become NULL
+static bool BreakpointStrings(const uchar *data, unsigned int size, wchar_t *text[3])
+{
+    wchar_t *p = (wchar_t *)(data + sizeof(breakpoint_t));
+    wchar_t *end = (wchar_t *)(data + size);
+
+    if (size < sizeof(breakpoint_t))
+        return false;
+
+    for (int i = 0; i < 3; i++) {
+        wchar_t *s = p;
+
+        while (p < end && *p)
+            p++;
+
+        if (p == end)
+            return false;
+
+        text[i] = *s ? s : NULL;
+        p++;
+    }
+
+    return true;
+}
+
+// Writes the INT3, memory and hardware breakpoints and the patches of the
+// module to MODULE-breakpoints.bin, addresses relative to the module base
+static bool SaveBreakpoints(t_module *module)
+{
+    wchar_t unicode[TEXTLEN];
+    char path[MAXPATH];
+    char message[1024];
+    uchar data[sizeof(ulong) + 2 * PATCHSIZE];
+    records_t records = { { 0 } };
+    ulong end = module->base + module->size;
+    int counts[4] = { 0 };
+
+    ModuleIdentity(module, records.identity, sizeof records.identity);
+
+    for (int i = 0; i < bpoint.sorted.n; i++) {
+        const t_bpoint *bp = Getsortedbyindex((t_sorted *)&bpoint.sorted, i);
+        breakpoint_t b = { 1, bp->type, bp->limit, bp->actions, bp->fnindex };
+
+        if (bp->addr < module->base || bp->addr >= end)
+            continue;
+
+        counts[0] += AddBreakpoint(&records, bp->addr - module->base, BREAK_INT3, &b, bp->addr, NM_INT3BASE);
+    }
+
+    for (int i = 0; i < bpmem.sorted.n; i++) {
+        const t_bpmem *bp = Getsortedbyindex((t_sorted *)&bpmem.sorted, i);
+        breakpoint_t b = { bp->size, bp->type, bp->limit, 0, 0 };
+
+        if (bp->addr < module->base || bp->addr >= end)
+            continue;
+
+        counts[1] += AddBreakpoint(&records, bp->addr - module->base, BREAK_MEM, &b, bp->addr, NM_MEMBASE);
+    }
+
+    // the names of hardware breakpoints are kept by slot, not by address
+    for (int i = 0; i < bphard.sorted.n; i++) {
+        const t_bphard *bp = Getsortedbyindex((t_sorted *)&bphard.sorted, i);
+        breakpoint_t b = { bp->size, bp->type, bp->limit, bp->actions, bp->fnindex };
+
+        if (bp->addr < module->base || bp->addr >= end)
+            continue;
+
+        counts[2] += AddBreakpoint(&records, bp->addr - module->base, BREAK_HARD, &b, bp->index, NM_HARDBASE);
+    }
+
+    for (int i = 0; i < patch.sorted.n; i++) {
+        const t_patch *pt = Getsortedbyindex((t_sorted *)&patch.sorted, i);
+
+        if (pt->addr < module->base || pt->addr >= end || pt->size == 0 || pt->size > PATCHSIZE)
+            continue;
+
+        memcpy(data, &pt->type, sizeof(ulong));
+        memcpy(data + sizeof(ulong), pt->orig, pt->size);
+        memcpy(data + sizeof(ulong) + pt->size, pt->mod, pt->size);
+
+        counts[3] += records_add(&records, pt->addr - module->base, BREAK_PATCH, data, sizeof(ulong) + 2 * pt->size);
+    }
+
+    ModuleFilePath(module, L"-breakpoints.bin", path, sizeof path);
+
+    bool ok = records_save(path, &records, message);
+    records_free(&records);
+
+    if (!ok) {
+        Utftounicode(message, strlen(message), unicode, _countof(unicode));
+        Flash(unicode);
+        return false;
+    }
+
+    Info(L"Saved %d INT3, %d memory and %d hardware breakpoints and %d patches of %s",
+        counts[0], counts[1], counts[2], counts[3], module->modname);
+    return true;
+}
+
+// Applies the patch records of one run in a single read and write. A patch
+// whose bytes are neither the original nor the patched ones is left alone.
+static int WritePatchRun(t_module *module, const records_t *records, const int *run, int n, uchar *buf)
+{
+    ulong first = records->items[run[0]].address;
+    ulong last = first;
+    int applied = 0;
+
+    for (int i = 0; i < n; i++) {
+        const record_t *r = &records->items[run[i]];
+        ulong size = (r->size - sizeof(ulong)) / 2;
+
+        if (r->address + size > last)
+            last = r->address + size;
+    }
+
+    ulong size = last - first;
+
+    if (Readmemory(buf, module->base + first, size, MM_SILENT) != size)
+        return 0;
+
+    for (int i = 0; i < n; i++) {
+        const record_t *r = &records->items[run[i]];
+        const uchar *data = RECORDS_DATA(records, run[i]) + sizeof(ulong);
+        ulong psize = (r->size - sizeof(ulong)) / 2;
+        uchar *at = buf + (r->address - first);
+
+        if (memcmp(at, data, psize) == 0) {
+            memcpy(at, data + psize, psize);
+            applied++;
+        } else if (memcmp(at, data + psize, psize) == 0) {
+            applied++;
+        }
+    }
+
+    if (applied && Writememory(buf, module->base + first, size, MM_SILENT | MM_ADJUSTINT3) != size)
+        return 0;
+
+    return applied;
+}
+
+// Restores MODULE-breakpoints.bin: the patches first, coalesced into as few
+// writes as possible, then the breakpoints on top of the patched code
+static bool LoadBreakpoints(t_module *module)
+{
+    wchar_t unicode[TEXTLEN];
+    char path[MAXPATH];
+    char message[1024];
+    char identity[64];
+    records_t records;
+    int counts[4] = { 0 };
+
+    ModuleFilePath(module, L"-breakpoints.bin", path, sizeof path);
+
+    if (!records_load(path, &records, message)) {
+        Utftounicode(message, strlen(message), unicode, _countof(unicode));
+        Flash(unicode);
+        return false;
+    }
+
+    ModuleIdentity(module, identity, sizeof identity);
+
+    if (records.identity[0] && identity[0] && strcmp(identity, records.identity) != 0) {
+        if (Condyesno(NULL, PLUGINNAME, L"The breakpoints of %s were saved from a different build.\n\nApply them anyway?", module->modname) != IDYES) {
+            records_free(&records);
+            Flash(L"Load cancelled, module identity does not match");
+            return false;
+        }
+    }
+
+    // patches were saved in address order, runs of them end at a gap
+    int *run = malloc((records.count + 1) * sizeof(int));
+    uchar *buf = malloc(PATCH_RUN);
+    ulong runend = 0;
+    int n = 0;
+
+    for (int i = 0; run && buf && i <= records.count; i++) {
+        const record_t *r = i < records.count ? &records.items[i] : NULL;
+        bool valid = r && r->type == BREAK_PATCH && r->size > sizeof(ulong) && (r->size - sizeof(ulong)) % 2 == 0
+            && r->address + (r->size - sizeof(ulong)) / 2 <= module->size;
+
+        if (r && !valid)
+            continue;
+
+        if (n && (!r || r->address > runend + PATCH_GAP || r->address < records.items[run[0]].address
+                || r->address + (r->size - sizeof(ulong)) / 2 - records.items[run[0]].address > PATCH_RUN)) {
+            counts[3] += WritePatchRun(module, &records, run, n, buf);
+            n = 0;
+        }
+
+        if (!r)
+            break;
+
+        ulong pend = r->address + (r->size - sizeof(ulong)) / 2;
+
+        if (n == 0 || pend > runend)
+            runend = pend;
+
+        run[n++] = i;
+    }
+
+    free(run);
+    free(buf);
+
+    for (int i = 0; i < records.count; i++) {
+        const record_t *r = &records.items[i];
+        const uchar *data = RECORDS_DATA(&records, i);
+        ulong addr = module->base + r->address;
+        breakpoint_t b;
+        wchar_t *text[3];
+
+        if (r->type == BREAK_PATCH || r->address >= module->size || !BreakpointStrings(data, r->size, text))
+            continue;
+
+        memcpy(&b, data, sizeof b);
+
+        ulong type = b.type & (BP_BASE | BP_COND | BP_ACCESSMASK | BP_MANMASK);
+        bool disabled = (b.type & BP_DISABLED) != 0;
+
+        switch (r->type) {
+            case BREAK_INT3:
+                if (Setint3breakpoint(addr, type, b.fnindex, b.limit, b.limit, b.actions, text[0], text[1], text[2]) == 0) {
+                    if (disabled)
+                        Enableint3breakpoint(addr, 0);
+                    counts[0]++;
+                }
+                break;
+
+            case BREAK_MEM:
+                if (Setmembreakpoint(addr, b.size, type, b.limit, b.limit, text[0], text[1], text[2]) == 0) {
+                    if (disabled)
+                        Enablemembreakpoint(addr, 0);
+                    counts[1]++;
+                }
+                break;
+
+            case BREAK_HARD: {
+                int slot = Findfreehardbreakslot(type);
+
+                if (slot >= 0 && Sethardbreakpoint(slot, b.size, type, b.fnindex, addr, b.limit, b.limit, b.actions, text[0], text[1], text[2]) == 0) {
+                    if (disabled)
+                        Enablehardbreakpoint(slot, 0);
+                    counts[2]++;
+                }
+                break;
+            }
+        }
+    }
+
+    Info(L"Restored %d INT3, %d memory and %d hardware breakpoints and %d patches of %s",
+        counts[0], counts[1], counts[2], counts[3], module->modname);
+
+    records_free(&records);
+    return true;
+}
+
+// Fingerprints every procedure OllyDbg found in the module. Relocated
+// operands, which Cmdinfo reports from the module's fixups, and branch
+// displacements are hashed as zeros, so code that only moved keeps its hash.
+static void FingerprintModule(t_module *module, fingerprints_t *fp)
+{
+    static uchar code[PORT_MAXPROC];
+    ulong end = module->base + module->size;
+    t_cmdinfo ci;
+
+    ModuleIdentity(module, fp->identity, sizeof fp->identity);
+
+    int first = Findsortedindexrange((t_sorted *)&procdata, module->base, end);
+
+    for (int i = first; first >= 0 && i < procdata.n; i++) {
+        const t_procdata *pd = Getsortedbyindex((t_sorted *)&procdata, i);
+        ulong size;
+        ulong amin, amax;
+
+        if (!pd || pd->addr >= end)
+            break;
+
+        size = pd->size;
+
+        if (size <= 1 && Getproclimits(pd->addr, &amin, &amax) == 0 && amin == pd->addr)
+            size = amax - amin + 1;
+
+        if (size <= 1 || size > sizeof code || pd->addr + size > end ||
+            Readmemory(code, pd->addr, size, MM_SILENT) != size)
+            continue;
+
+        unsigned long long hash = PORT_HASH_INIT;
+        unsigned long long shape = PORT_HASH_INIT;
+
+        for (ulong off = 0; off < size; ) {
+            uchar *cmd = code + off;
+            ulong len = Cmdinfo(cmd, size - off, pd->addr + off, &ci, 0, NULL);
+
+            if (len > 0 && len <= size - off) {
+                if (ci.memfixup != (ulong)-1 && ci.memfixup + 4 <= len)
+                    memset(cmd + ci.memfixup, 0, 4);
+                if (ci.immfixup != (ulong)-1 && ci.immfixup + 4 <= len)
+                    memset(cmd + ci.immfixup, 0, 4);
+                if (ci.jmpaddr)
+                    memset(cmd + len - (len >= 5 ? 4 : 1), 0, len >= 5 ? 4 : 1);
+            } else {
+                // undecodable, the rest is hashed as it is
+                len = size - off;
+            }
+
+            uchar op[2] = { len, cmd[ci.nprefix < len ? ci.nprefix : 0] };
+
+            hash = port_hash(hash, cmd, len);
+            shape = port_hash(shape, op, sizeof op);
+            off += len;
+        }
+
+        fingerprints_add(fp, pd->addr - module->base, size, hash, shape);
+    }
+}
+
+static bool SaveFingerprints(t_module *module)
+{
+    wchar_t unicode[TEXTLEN];
+    char path[MAXPATH];
+    char message[1024];
+    fingerprints_t fp = { { 0 } };
+
+    FingerprintModule(module, &fp);
+
+    ModuleFilePath(module, L"-fingerprints.bin", path, sizeof path);
+
+    bool ok = fingerprints_save(path, &fp, message);
+    fingerprints_free(&fp);
+
+    Utftounicode(message, strlen(message), unicode, _countof(unicode));
+
+    if (!ok) {
+        Flash(unicode);
+        return false;
+    }
+
+    Info(unicode);
+    return true;
+}
+
+// Whether a snapshot was saved from the build the fingerprints were taken
+// of, asks when it is not or can't be told
+static bool ConfirmFingerprints(const identity_t *identity, const fingerprints_t *fp, const wchar_t *snapshot, const wchar_t *fingerprints)
+{
+    char saved[64] = "";
+
+    if (identity->size)
+        backup_identity_string(identity, saved, sizeof saved);
+
+    if (!saved[0] || !fp->identity[0])
+        return Condyesno(NULL, PLUGINNAME, L"%s or %s does not record the build it was made from, so they can't be checked to match.\n\nUse them anyway?", snapshot, fingerprints) == IDYES;
+
+    if (strcmp(saved, fp->identity) != 0)
+        return Condyesno(NULL, PLUGINNAME, L"%s was saved from a different build than the fingerprints in %s.\n\nUse them anyway?", snapshot, fingerprints) == IDYES;
+
+    return true;
+}
+
+// Moves the names of a snapshot taken of an older build to where their
+// procedures are in this one. Every ported name goes to MODULE-ported.csv
+// with its confidence. The labels and comments at or above portconfidence
+// are applied, the names OllyDbg finds itself are left to its analysis.
+static void PortNames(t_module *module, const wchar_t *fingerprints, const wchar_t *snapshot)
+{
+    wchar_t unicode[TEXTLEN];
+    char utf[TEXTLEN];
+    char path[MAXPATH];
+    char message[1024];
+    fingerprints_t old;
+    fingerprints_t current = { { 0 } };
+    identity_t identity;
+
+    Unicodetoutf(fingerprints, wcslen(fingerprints), utf, _countof(utf));
+
+    if (!fingerprints_load(utf, &old, message)) {
+        Utftounicode(message, strlen(message), unicode, _countof(unicode));
+        Flash(unicode);
+        return;
+    }
+
+    Unicodetoutf(snapshot, wcslen(snapshot), utf, _countof(utf));
+
+    rva_t *rvas = backup_load(utf, &identity, message);
+
+    if (rvas == NULL) {
+        fingerprints_free(&old);
+        Utftounicode(message, strlen(message), unicode, _countof(unicode));
+        Flash(unicode);
+        return;
+    }
+
+    // the names are moved by the procedures of the fingerprinted build
+    if (!ConfirmFingerprints(&identity, &old, snapshot, fingerprints)) {
+        LIST_FREE(rvas);
+        fingerprints_free(&old);
+        Flash(L"Port cancelled, the snapshot and the fingerprints are of different builds");
+        return;
+    }
 
+    names_t names = { 0 };
+    SnapshotNames(rvas, &names);
     LIST_FREE(rvas);
 
-    Mergequickdata();
+    FingerprintModule(module, &current);
+
+    port_match_t *matches;
+    int nmatches = port_match(&old, &current, &matches);
+
+    ModuleFilePath(module, L"-ported.csv", path, sizeof path);
+    FILE *fh = fopen(path, "wb");
+
+    if (fh)
+        fprintf(fh, "old_RVA,confidence,RVA,label_type,label\r\n");
+
+    names_t ported = { 0 };
+    unsigned int mask = NameTypesMask(UserNameTypes);
+    int user = 0;
+    int low = 0;
+    int lost = 0;
+
+    for (int i = 0; i < names.count; i++) {
+        const char *name = NAMES_STR(&names, i);
+        unsigned int to;
+        int confidence = port_address(matches, nmatches, names.items[i].address, &to);
+
+        if (confidence && fh) {
+            fprintf(fh, "%08X,%d,", names.items[i].address, confidence);
+            backup_write_row(fh, to, NameTypeString(names.items[i].type), name);
+        }
+
+        if (!(mask & NameTypeBit(names.items[i].type)))
+            continue;
+
+        user++;
+
+        if (!confidence)
+            lost++;
+        else if (confidence >= portconfidence)
+            names_add(&ported, to, names.items[i].type, name);
+        else
+            low++;
+    }
+
+    if (fh)
+        fclose(fh);
+
+    names_sort(&ported);
+
+    JOIN_STATS stats;
+    ApplyNames(module, module->base, module->base + module->size, &ported, UserNameTypes, false, &stats);
+
+    Info(L"Ported %d of %d labels and comments through %d of %d procedures, %d below confidence %d, %d outside matched procedures",
+         ported.count, user, nmatches, old.count, low, portconfidence, lost);
+
+    free(matches);
+    names_free(&ported);
+    names_free(&names);
+    fingerprints_free(&current);
+    fingerprints_free(&old);
+}
+
+// backup-corpus.bin in the plugin data directory unless the ini names another
+static void CorpusPath(char *dst, size_t size)
+{
+    wchar_t path[MAXPATH];
+
+    if (Stringfromini(PLUGINNAME, L"Signature corpus", path, _countof(path)) <= 0)
+        swprintf(path, _countof(path), L"%s\\backup-corpus.bin", plugindir);
+
+    Unicodetoutf(path, wcslen(path), dst, size);
+}
+
+// Adds the labels at the entry of fingerprinted procedures to the corpus.
+// Both lists are sorted by address.
+static void AddToCorpus(const fingerprints_t *fp, const names_t *names)
+{
+    wchar_t unicode[TEXTLEN];
+    char path[MAXPATH];
+    char message[1024];
+    WIN32_FILE_ATTRIBUTE_DATA attr;
+    corpus_t corpus;
+    int added = 0;
+    int j = 0;
+
+    CorpusPath(path, sizeof path);
+
+    // a missing corpus is started, a damaged one is not overwritten
+    if (!GetFileAttributesExA(path, GetFileExInfoStandard, &attr)) {
+        memset(&corpus, 0, sizeof corpus);
+    } else if (!corpus_load(path, &corpus, message)) {
+        Utftounicode(message, strlen(message), unicode, _countof(unicode));
+        Flash(unicode);
+        return;
+    }
+
+    for (int i = 0; i < fp->count; i++) {
+        const fingerprint_t *f = &fp->items[i];
+
+        while (j < names->count && names->items[j].address < f->address)
+            j++;
+
+        for (int k = j; k < names->count && names->items[k].address == f->address; k++) {
+            if (names->items[k].type == NM_LABEL && f->size >= CORPUS_MINSIZE) {
+                added += corpus_add(&corpus, f->hash, f->size, NAMES_STR(names, k));
+                break;
+            }
+        }
+    }
+
+    message[0] = '\0';
+
+    bool ok = corpus_finish(&corpus) && corpus_save(path, &corpus, message);
+
+    if (!ok && !message[0])
+        strcpy(message, "Out of memory");
 
     Utftounicode(message, strlen(message), unicode, _countof(unicode));
-    Info(unicode);
+
+    if (ok)
+        Info(L"Added %d labelled procedures, %s", added, unicode);
+    else
+        Flash(unicode);
+
+    corpus_free(&corpus);
 }
 
-static void SaveToFile(t_module *module, const wchar_t *filename, const NAME_TYPE** Names)
+static void AddModuleToCorpus(t_module *module)
 {
-    if (Names) {
-        unsigned int end = module->base + module->size;
+    fingerprints_t fp = { { 0 } };
+    names_t names = { 0 };
+    int list[] = { NM_LABEL };
 
-        wchar_t unicode[TEXTLEN];
-        wchar_t buffer[TEXTLEN];
-        wchar_t buffer2[TEXTLEN];
-        char utf[TEXTLEN];
+    FingerprintModule(module, &fp);
+    EnumerateNameList(module, list, _countof(list), &names);
 
-        rva_t *rvas = NULL;
+    AddToCorpus(&fp, &names);
 
-        for (unsigned int address = end; address > module->base; address--) {
-            int i = 0;
-            do {
-                buffer[0] = L"\0";
-                FindnameW(address, Names[i]->type == NM_ANLABEL + 1 ? NM_ANLABEL : Names[i]->type, buffer, _countof(buffer));
-                if (buffer[0]) {
-                    rva_t *rva = malloc(sizeof(rva_t));
-                    rva->address = address - module->base;
-                    rva->raw_type = Names[i]->type;
-                    if (Names[i]->type == NM_ANLABEL) {
-                        memcpy(&buffer2, &buffer, sizeof(buffer));
-                        if (DemanglenameW(&buffer2, &buffer2, 0)) {
-                            Unicodetoutf(buffer2, _countof(buffer2), rva->name, sizeof(rva->name));
-                        } else {
-                            Unicodetoutf(buffer, _countof(buffer), rva->name, sizeof(rva->name));
-                        }
-                    } else if (Names[i]->type == NM_ANLABEL + 1) {
-                        memcpy(&buffer2, &buffer, sizeof(buffer));
-                        if (DemanglenameW(&buffer2, &buffer2, 0)) {
-                            Unicodetoutf(buffer, _countof(buffer), rva->name, sizeof(rva->name));
-                        } else {
-                            free(rva);
-                            continue;
-                        }
-                    } else {
-                        Unicodetoutf(buffer, _countof(buffer), rva->name, sizeof(rva->name));
-                    }
-                    LIST_INSERT(rvas, rva);
-                }
-            } while (Names[++i]);
+    names_free(&names);
+    fingerprints_free(&fp);
+}
+
+// The names of a snapshot, placed by the fingerprints saved of the same build
+static void AddSnapshotToCorpus(const wchar_t *fingerprints, const wchar_t *snapshot)
+{
+    wchar_t unicode[TEXTLEN];
+    char utf[TEXTLEN];
+    char message[1024];
+    fingerprints_t fp;
+    identity_t identity;
+
+    Unicodetoutf(fingerprints, wcslen(fingerprints), utf, _countof(utf));
+
+    if (!fingerprints_load(utf, &fp, message)) {
+        Utftounicode(message, strlen(message), unicode, _countof(unicode));
+        Flash(unicode);
+        return;
+    }
+
+    Unicodetoutf(snapshot, wcslen(snapshot), utf, _countof(utf));
+
+    rva_t *rvas = backup_load(utf, &identity, message);
+
+    if (rvas == NULL) {
+        fingerprints_free(&fp);
+        Utftounicode(message, strlen(message), unicode, _countof(unicode));
+        Flash(unicode);
+        return;
+    }
+
+    if (!ConfirmFingerprints(&identity, &fp, snapshot, fingerprints)) {
+        LIST_FREE(rvas);
+        fingerprints_free(&fp);
+        Flash(L"Nothing added, the snapshot and the fingerprints are of different builds");
+        return;
+    }
+
+    names_t names = { 0 };
+    SnapshotNames(rvas, &names);
+    LIST_FREE(rvas);
+
+    AddToCorpus(&fp, &names);
+
+    names_free(&names);
+    fingerprints_free(&fp);
+}
+
+// Labels every procedure of the module that has no label yet and whose
+// fingerprint the corpus knows, in one batch
+static void LabelFromCorpus(t_module *module)
+{
+    wchar_t unicode[TEXTLEN];
+    char path[MAXPATH];
+    char message[1024];
+    corpus_t corpus;
+    fingerprints_t fp = { { 0 } };
+    names_t names = { 0 };
+    int list[] = { NM_LABEL };
+    int labelled = 0;
+    int known = 0;
+    int j = 0;
+
+    CorpusPath(path, sizeof path);
+
+    if (!corpus_load(path, &corpus, message)) {
+        Utftounicode(message, strlen(message), unicode, _countof(unicode));
+        Flash(unicode);
+        return;
+    }
+
+    FingerprintModule(module, &fp);
+    EnumerateNameList(module, list, _countof(list), &names);
+
+    for (int i = 0; i < fp.count; i++) {
+        const fingerprint_t *f = &fp.items[i];
+        const char *label = corpus_find(&corpus, f->hash, f->size);
+
+        if (!label)
+            continue;
+
+        known++;
+
+        while (j < names.count && names.items[j].address < f->address)
+            j++;
+
+        if (j < names.count && names.items[j].address == f->address)
+            continue;
+
+        engine_insert(module->base + f->address, NM_LABEL, label);
+        labelled++;
+    }
+
+    if (labelled)
+        engine_merge();
+
+    Info(L"Labelled %d procedures of %s from the corpus, %d of %d were known", labelled, module->modname, known, fp.count);
+
+    names_free(&names);
+    fingerprints_free(&fp);
+    corpus_free(&corpus);
+}
+
+static void SaveAllModules(const wchar_t *filename)
+{
+    wchar_t unicode[TEXTLEN];
+    char utf[MAXPATH];
+    char message[1024];
+
+    archive_t *modules = NULL;
+
+    // walk backwards so the list ends up in address order
+    for (int i = module.sorted.n - 1; i >= 0; i--) {
+        t_module *pmod = Getsortedbyindex((t_sorted *)&module.sorted, i);
+        if (pmod == NULL)
+            continue;
+
+        archive_t *a = LIST_ALLOC(archive_t);
+        EnumerateNames(pmod, UserNameTypes, &a->names);
+
+        if (a->names.count == 0) {
+            names_free(&a->names);
+            free(a);
+            continue;
         }
 
-        char message[1024];
-        Unicodetoutf(filename, wcslen(filename), utf, _countof(utf));
+        Unicodetoutf(pmod->modname, wcslen(pmod->modname), a->module, sizeof a->module);
+        a->base = pmod->base;
+        a->size = pmod->size;
+        ModuleIdentity(pmod, a->identity, sizeof a->identity);
 
-        if (backup_save_2(utf, rvas, message)) {
-            Utftounicode(message, strlen(message), unicode, _countof(unicode));
-            Info(unicode);
-        } else {
-            Utftounicode(message, strlen(message), unicode, _countof(unicode));
-            Flash(unicode);
+        LIST_INSERT(modules, a);
+    }
+
+    Unicodetoutf(filename, wcslen(filename), utf, _countof(utf));
+
+    bool ret = backup_save_archive(utf, modules, NameTypeString, message);
+
+    backup_free_archive(modules);
+
+    Utftounicode(message, strlen(message), unicode, _countof(unicode));
+    if (ret) {
+        Info(unicode);
+    } else {
+        Flash(unicode);
+    }
+}
+
+static void LoadAllModules(const wchar_t *filename)
+{
+    wchar_t unicode[TEXTLEN];
+    char utf[MAXPATH];
+    char message[1024];
+    char identity[128];
+
+    Unicodetoutf(filename, wcslen(filename), utf, _countof(utf));
+
+    archive_t *modules = backup_load_archive(utf, ParseNameType, message);
+
+    if (modules == NULL) {
+        Utftounicode(message, strlen(message), unicode, _countof(unicode));
+        Flash(unicode);
+        return;
+    }
+
+    int applied = 0;
+    int skipped = 0;
+    int outside = 0;
+
+    LIST_FOREACH (modules, archive_t, a) {
+        if (a->names.count == 0)
+            continue;
+
+        Utftounicode(a->module, strlen(a->module), unicode, _countof(unicode));
+        t_module *pmod = Findmodulebyname(unicode);
+
+        if (pmod == NULL || pmod->size != a->size) {
+            Addtolist(0, DRAW_HILITE, L"Skipped %s, no matching module loaded", unicode);
+            skipped++;
+            continue;
+        }
+
+        ModuleIdentity(pmod, identity, sizeof identity);
+        if (a->identity[0] && identity[0] && strcmp(a->identity, identity) != 0) {
+            Addtolist(pmod->base, DRAW_HILITE, L"Skipped %s, the file on disk has changed", unicode);
+            skipped++;
+            continue;
+        }
+
+        for (int i = 0; i < a->names.count; i++) {
+            if (a->names.items[i].address >= pmod->size) {
+                outside++;
+                continue;
+            }
+
+            engine_insert(pmod->base + a->names.items[i].address, a->names.items[i].type, NAMES_STR(&a->names, i));
         }
+
+        applied++;
+    }
+
+    backup_free_archive(modules);
+
+    // one merge for all modules
+    if (applied)
+        engine_merge();
+
+    if (outside) {
+        Info(L"Loaded names of %d modules from %s, %d skipped, %d names outside their module ignored", applied, filename, skipped, outside);
     } else {
-        Flash(L"Internal name type error");
+        Info(L"Loaded names of %d modules from %s, %d skipped", applied, filename, skipped);
+    }
+}
+
+#define UDD_TAG_NAMES       0x6D614E0AL     // Packed user names, written by FlushUddNames() from ODBG2_Pluginsaveudd()
+#define UDD_NAMES_VERSION   1
+#define UDD_CHUNK_SIZE      49152           // Flush a record when the buffer exceeds this
+
+static void FlushUddNames(t_uddsave *psave, uchar *buf, ulong *size, ulong *count)
+{
+    if (*count == 0)
+        return;
+
+    ulong header[2] = { UDD_NAMES_VERSION, *count };
+    memcpy(buf, header, sizeof header);
+
+    Pluginpackedrecord(psave, UDD_TAG_NAMES, *size, buf);
+
+    *size = sizeof header;
+    *count = 0;
+}
+
+// Record layout: ulong version, ulong count, then count times
+// ulong offset, uchar type, ushort length and length UTF-16 characters.
+extc void _export cdecl ODBG2_Pluginsaveudd(t_uddsave *psave, t_module *pmod, int ismainmodule)
+{
+    if (!initialized || !embedudd || pmod == NULL)
+        return;
+
+    int list[_countof(RawTypeLookup)];
+    int n = NameTypeList(UserNameTypes, list);
+
+    uchar *buf = malloc(UDD_CHUNK_SIZE + 16 + TEXTLEN * sizeof(wchar_t));
+    if (!buf)
+        return;
+
+    ulong size = 2 * sizeof(ulong);
+    ulong count = 0;
+
+    wchar_t name[TEXTLEN];
+    ulong addr;
+    int type;
+    int len;
+
+    Startnextnamelist(pmod->base, pmod->base + pmod->size, list, n);
+
+    while ((len = FindnextnamelistW(&addr, &type, name, _countof(name))) > 0) {
+        ulong offs = addr - pmod->base;
+        uchar t = (uchar)type;
+        ushort l = (ushort)len;
+
+        memcpy(buf + size, &offs, sizeof offs);
+        size += sizeof offs;
+        buf[size++] = t;
+        memcpy(buf + size, &l, sizeof l);
+        size += sizeof l;
+        memcpy(buf + size, name, len * sizeof(wchar_t));
+        size += len * sizeof(wchar_t);
+        count++;
+
+        if (size > UDD_CHUNK_SIZE)
+            FlushUddNames(psave, buf, &size, &count);
+    }
+
+    FlushUddNames(psave, buf, &size, &count);
+    free(buf);
+}
+
+extc void _export cdecl ODBG2_Pluginuddrecord(t_module *pmod, int ismainmodule, ulong tag, ulong size, void *data)
+{
+    ulong header[2];
+    wchar_t name[TEXTLEN];
+
+    if (!initialized || pmod == NULL || tag != UDD_TAG_NAMES || size < sizeof header)
+        return;
+
+    const uchar *p = data;
+    const uchar *end = p + size;
+
+    memcpy(header, p, sizeof header);
+    p += sizeof header;
+
+    if (header[0] != UDD_NAMES_VERSION)
+        return;
+
+    for (ulong i = 0; i < header[1]; i++) {
+        ulong offs;
+        ushort len;
+
+        if (end - p < (int)(sizeof offs + 1 + sizeof len))
+            break;
+
+        memcpy(&offs, p, sizeof offs);
+        p += sizeof offs;
+        uchar type = *p++;
+        memcpy(&len, p, sizeof len);
+        p += sizeof len;
+
+        if (len >= TEXTLEN || end - p < (int)(len * sizeof(wchar_t)) || offs >= pmod->size)
+            break;
+
+        memcpy(name, p, len * sizeof(wchar_t));
+        name[len] = L'\0';
+        p += len * sizeof(wchar_t);
+
+        if (type == NM_LABEL || type == NM_COMMENT)
+            QuickinsertnameW(pmod->base + offs, type, name);
     }
+
+    Mergequickdata();
 }
 
 static void SmartSaveToFile(t_module *module, const wchar_t *filename, const NAME_TYPE** Names)
@@ -732,7 +4255,7 @@ static void SmartSaveToFile(t_module *module, const wchar_t *filename, const NAM
         char message[1024];
         Unicodetoutf(filename, wcslen(filename), utf, _countof(utf));
 
-        if (backup_save_2(utf, rvas, message)) {
+        if (backup_save_2(utf, rvas, NameTypesMask(Names), NULL, message)) {
             Utftounicode(message, strlen(message), unicode, _countof(unicode));
             Info(unicode);
         } else {